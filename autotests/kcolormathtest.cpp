@@ -0,0 +1,93 @@
+/*
+    SPDX-FileCopyrightText: 2026 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include <QTest>
+
+#include <kcolormath.h>
+#include <kcolorutils.h>
+
+// Evaluated by the compiler, so that this fails to build if any of these
+// stops being constexpr
+static_assert(KColorMath::luma(0xffffffff) == 1.0);
+static_assert(KColorMath::luma(0xff000000) == 0.0);
+static_assert(KColorMath::contrastRatio(0xffffffff, 0xff000000) == 21.0);
+static_assert(KColorMath::contrastRatio(0xff3daee9, 0xff3daee9) == 1.0);
+static_assert(KColorMath::gamma(0.0) == 0.0 && KColorMath::gamma(1.0) == 1.0);
+static_assert(KColorMath::inverseGamma(KColorMath::gamma(0.5)) > 0.4999999 && KColorMath::inverseGamma(KColorMath::gamma(0.5)) < 0.5000001);
+static_assert(KColorMath::fromHcy(KColorMath::toHcy(0xff3daee9)) == 0xff3daee9);
+static_assert(KColorMath::fromHcy(KColorMath::toHcy(0x80123456)) == 0x80123456);
+static_assert(KColorMath::mix(0xff102030, 0x80405060, 0.0) == 0xff102030);
+static_assert(KColorMath::mix(0xff102030, 0x80405060, 1.0) == 0x80405060);
+static_assert(KColorMath::mix(0xff000000, 0xffffffff, 0.5) == 0xff808080);
+static_assert(KColorMath::lighten(0xffffffff, 0.5) == 0xffffffff);
+static_assert(KColorMath::darken(0xff3daee9, 1.0) == 0xff000000);
+static_assert(KColorMath::contrastRatio(KColorMath::lighten(0xff3daee9, 0.2), 0xff232629) > KColorMath::contrastRatio(0xff3daee9, 0xff232629));
+
+static int channelError(QRgb c1, QRgb c2)
+{
+    return qMax(qMax(qMax(qAbs(qRed(c1) - qRed(c2)), qAbs(qGreen(c1) - qGreen(c2))), qAbs(qBlue(c1) - qBlue(c2))), qAbs(qAlpha(c1) - qAlpha(c2)));
+}
+
+class KColorMathTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testChannel8()
+    {
+        for (int i = 0; i <= USHRT_MAX; ++i) {
+            const qreal value = i / qreal(USHRT_MAX);
+            const int channel = KColorMathPrivate::channel8(value);
+            QCOMPARE(channel, QColor::fromRgba64(i, i, i, i).red());
+            QCOMPARE(channel, QColor::fromRgbF(value, value, value).red());
+        }
+        QCOMPARE(KColorMathPrivate::channel8(-0.5), 0);
+        QCOMPARE(KColorMathPrivate::channel8(1.5), 255);
+    }
+
+    void testGamma()
+    {
+        for (int i = 0; i <= 1000; ++i) {
+            const qreal n = i / 1000.0;
+            QVERIFY(qAbs(KColorMath::gamma(n) - pow(n, 2.2)) <= 1e-12);
+            QVERIFY(qAbs(KColorMath::inverseGamma(n) - pow(n, 1.0 / 2.2)) <= 1e-12);
+        }
+        QCOMPARE(KColorMath::gamma(-1.0), 0.0);
+        QCOMPARE(KColorMath::inverseGamma(2.0), 1.0);
+    }
+
+    void testKColorUtils()
+    {
+        // The same results as KColorUtils, but for a rare rounding difference
+        quint32 seed = 1;
+        for (int i = 0; i < 2000; ++i) {
+            seed = seed * 1664525 + 1013904223;
+            const QRgb rgb = seed | 0xff000000;
+            const QRgb other = (seed >> 8) | 0xff000000;
+            const QColor color = QColor::fromRgba(rgb);
+
+            QVERIFY(qAbs(KColorMath::luma(rgb) - KColorUtils::luma(color)) <= 1e-12);
+            QVERIFY(qAbs(KColorMath::contrastRatio(rgb, other) - KColorUtils::contrastRatio(color, QColor::fromRgba(other))) <= 1e-9);
+
+            const KColorMath::Hcy hcy = KColorMath::toHcy(rgb);
+            qreal h;
+            qreal c;
+            qreal y;
+            KColorUtils::getHcy(color, &h, &c, &y);
+            QVERIFY(qAbs(hcy.h - h) <= 1e-9 && qAbs(hcy.c - c) <= 1e-9 && qAbs(hcy.y - y) <= 1e-12);
+
+            QVERIFY(channelError(KColorMath::lighten(rgb, 0.3, 0.8), KColorUtils::lighten(color, 0.3, 0.8).rgba()) <= 1);
+            QVERIFY(channelError(KColorMath::darken(rgb, 0.3, 0.8), KColorUtils::darken(color, 0.3, 0.8).rgba()) <= 1);
+            QVERIFY(channelError(KColorMath::shade(rgb, -0.2, 0.1), KColorUtils::shade(color, -0.2, 0.1).rgba()) <= 1);
+
+            const QRgb translucent = (other & 0x00ffffff) | ((seed & 0xff) << 24);
+            QCOMPARE(KColorMath::mix(rgb, translucent, 0.3), KColorUtils::mix(color, QColor::fromRgba(translucent), 0.3).rgba());
+        }
+    }
+};
+
+QTEST_MAIN(KColorMathTest)
+
+#include "kcolormathtest.moc"
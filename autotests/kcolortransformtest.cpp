@@ -0,0 +1,156 @@
+/*
+    SPDX-FileCopyrightText: 2026 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include <QImage>
+#include <QTest>
+
+#include <kcolortransform.h>
+#include <kcolorutils.h>
+
+using KColorUtils::RecolorOperation;
+
+static const QColor accent(0x3d, 0xae, 0xe9);
+
+static QList<KColorTransform::Step> iconSteps()
+{
+    return {
+        {RecolorOperation::Tint, {accent, 0.4, std::nullopt}},
+        {RecolorOperation::Lighten, {QColor(), 0.2, 0.9}},
+        {RecolorOperation::Mix, {Qt::white, 0.1, std::nullopt}},
+    };
+}
+
+// What the steps give without a table
+static QRgb transformed(QRgb rgb)
+{
+    QColor color = QColor::fromRgba(rgb);
+    QColor paint = accent;
+    paint.setAlpha(color.alpha());
+    color = KColorUtils::tint(color, paint, 0.4);
+    color = KColorUtils::lighten(color, 0.2, 0.9);
+    paint = Qt::white;
+    paint.setAlpha(color.alpha());
+    return KColorUtils::mix(color, paint, 0.1).rgba();
+}
+
+static int channelError(QRgb c1, QRgb c2)
+{
+    return qMax(qMax(qAbs(qRed(c1) - qRed(c2)), qAbs(qGreen(c1) - qGreen(c2))), qAbs(qBlue(c1) - qBlue(c2)));
+}
+
+class KColorTransformTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testNull()
+    {
+        const KColorTransform transform;
+        QVERIFY(transform.isNull());
+        QCOMPARE(transform.map(0x80123456), 0x80123456);
+        QVERIFY(transform.toByteArray().isEmpty());
+        QVERIFY(KColorTransform::fromByteArray(QByteArray("garbage")).isNull());
+    }
+
+    void testMap_data()
+    {
+        QTest::addColumn<int>("gridSize");
+        QTest::addColumn<double>("maxMeanError");
+
+        // As measured, with some headroom
+        QTest::addRow("17") << 17 << 2.0;
+        QTest::addRow("33") << 33 << 0.75;
+    }
+
+    void testMap()
+    {
+        QFETCH(int, gridSize);
+        QFETCH(double, maxMeanError);
+
+        const KColorTransform transform(iconSteps(), gridSize);
+        QVERIFY(!transform.isNull());
+        QCOMPARE(transform.gridSize(), gridSize);
+        QCOMPARE(transform.steps().size(), qsizetype(3));
+
+        // The corners of the RGB cube are grid points
+        for (QRgb corner : {0xff000000, 0xffff0000, 0xff00ff00, 0xff0000ff, 0xffffff00, 0xffff00ff, 0xff00ffff, 0xffffffff}) {
+            QVERIFY(channelError(transform.map(corner), transformed(corner)) <= 1);
+        }
+
+        // Alpha is kept
+        QCOMPARE(qAlpha(transform.map(0x40808080)), 0x40);
+
+        quint32 seed = 1;
+        qint64 totalError = 0;
+        const int count = 5000;
+        for (int i = 0; i < count; ++i) {
+            seed = seed * 1664525 + 1013904223;
+            const QRgb color = seed | 0xff000000;
+            totalError += channelError(transform.map(color), transformed(color));
+        }
+        const double meanError = double(totalError) / count;
+        QVERIFY2(meanError <= maxMeanError, qPrintable(QString::number(meanError)));
+    }
+
+    void testApply()
+    {
+        const KColorTransform transform(iconSteps());
+
+        QImage image(16, 16, QImage::Format_ARGB32_Premultiplied);
+        for (int y = 0; y < image.height(); ++y) {
+            for (int x = 0; x < image.width(); ++x) {
+                image.setPixel(x, y, qPremultiply(qRgba(x * 16, y * 16, 128, (x + y) * 8)));
+            }
+        }
+
+        QImage applied = image;
+        transform.apply(applied);
+        QCOMPARE(applied.format(), QImage::Format_ARGB32_Premultiplied);
+        for (int y = 0; y < image.height(); ++y) {
+            for (int x = 0; x < image.width(); ++x) {
+                const QRgb color = image.pixel(x, y);
+                const QRgb expected = qAlpha(color) ? qPremultiply(transform.map(qUnpremultiply(color))) : color;
+                QCOMPARE(applied.pixel(x, y), expected);
+            }
+        }
+    }
+
+    void testSerialization()
+    {
+        const KColorTransform transform(iconSteps(), 9);
+        const QByteArray data = transform.toByteArray();
+
+        const KColorTransform restored = KColorTransform::fromByteArray(data);
+        QVERIFY(!restored.isNull());
+        QCOMPARE(restored.gridSize(), 9);
+        QCOMPARE(restored.toByteArray(), data);
+        QCOMPARE(restored.steps().size(), transform.steps().size());
+        QCOMPARE(restored.steps().at(1).parameters.chroma.value_or(0.0), 0.9);
+        QVERIFY(!restored.steps().at(2).parameters.chroma.has_value());
+        for (QRgb color : {0xff000000, 0xff3daee9, 0xff808080, 0x80ffffff}) {
+            QCOMPARE(restored.map(color), transform.map(color));
+        }
+
+        // Truncated or extended data is rejected
+        QVERIFY(KColorTransform::fromByteArray(data.left(data.size() - 1)).isNull());
+        QVERIFY(KColorTransform::fromByteArray(data + '\0').isNull());
+    }
+
+    void testCached()
+    {
+        const QList<KColorTransform::Step> steps = {{RecolorOperation::Darken, {QColor(), 0.3, std::nullopt}}};
+        const KColorTransform transform = KColorTransform::cached(steps, 5);
+        QCOMPARE(transform.gridSize(), 5);
+        QCOMPARE(KColorTransform::cached(steps, 5).toByteArray(), transform.toByteArray());
+        QCOMPARE(transform.toByteArray(), KColorTransform(steps, 5).toByteArray());
+
+        // Another grid size is another table
+        QCOMPARE(KColorTransform::cached(steps, 7).gridSize(), 7);
+    }
+};
+
+QTEST_MAIN(KColorTransformTest)
+
+#include "kcolortransformtest.moc"
@@ -0,0 +1,81 @@
+/*
+    SPDX-FileCopyrightText: 2026 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include <QTest>
+
+#include "../colors/kcolorspaces.cpp" // private implementation
+#include "../colors/kcolorspaces_p.h" // private header
+#include <kcolorutils.h>
+
+static qreal ratioForLuma(qreal y1, qreal y2)
+{
+    return (qMax(y1, y2) + 0.05) / (qMin(y1, y2) + 0.05);
+}
+
+// tint() as it used to be, with a bisection in 12 iterations
+static QColor bisectedTint(const QColor &base, const QColor &color, qreal amount)
+{
+    const qreal baseLuma = KColorUtils::luma(base);
+    const qreal rg = 1.0 + ((ratioForLuma(baseLuma, KColorUtils::luma(color)) + 1.0) * amount * amount * amount);
+
+    double u = 1.0;
+    double l = 0.0;
+    double a = 0.5;
+    for (int i = 12; i; --i) {
+        a = 0.5 * (l + u);
+        const qreal mixLuma = KColorUtils::luma(KColorUtils::mix(base, color, pow(a, 0.3)));
+        if (ratioForLuma(baseLuma, baseLuma + (mixLuma - baseLuma) * a) > rg) {
+            u = a;
+        } else {
+            l = a;
+        }
+    }
+
+    KColorSpaces::KHCY result(KColorUtils::mix(base, color, pow(a, 0.3)));
+    result.y = baseLuma + (result.y - baseLuma) * a;
+    return result.qColor();
+}
+
+class KColorUtilsBenchmark : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void benchTint_data()
+    {
+        QTest::addColumn<bool>("bisect");
+        QTest::addColumn<qreal>("amount");
+
+        // Roughly what color schemes use, and a goal ratio that can't be reached
+        for (qreal amount : {0.1, 0.3, 0.9}) {
+            QTest::addRow("bisection-%g", amount) << true << amount;
+            QTest::addRow("tint-%g", amount) << false << amount;
+        }
+    }
+
+    void benchTint()
+    {
+        QFETCH(bool, bisect);
+        QFETCH(qreal, amount);
+
+        QList<QColor> colors;
+        for (const char *name : {"#fcfcfc", "#eff0f1", "#31363b", "#232629", "#3daee9", "#2980b9", "#da4453", "#27ae60", "#f67400", "#fdbc4b"}) {
+            colors << QColor(QLatin1String(name));
+        }
+
+        QBENCHMARK {
+            for (const QColor &base : std::as_const(colors)) {
+                for (const QColor &color : std::as_const(colors)) {
+                    const QColor tinted = bisect ? bisectedTint(base, color, amount) : KColorUtils::tint(base, color, amount);
+                    Q_UNUSED(tinted);
+                }
+            }
+        }
+    }
+};
+
+QTEST_MAIN(KColorUtilsBenchmark)
+
+#include "kcolorutilsbenchmark.moc"
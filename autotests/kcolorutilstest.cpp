@@ -1,7 +1,12 @@
 #include "kcolorutilstest.h"
 
+#include <QImage>
+#include <QPainter>
 #include <QTest>
 
+#include <cstring>
+#include <vector>
+
 #include "../colors/kcolorspaces.cpp" // private implementation
 #include "../colors/kcolorspaces_p.h" // private header
 #include <kcolorutils.h>
@@ -43,6 +48,71 @@ void tst_KColorUtils::testOverlay()
     QCOMPARE(blended.blue(), color2.blue());
 }
 
+// overlayColors() as it used to be, painting on an image
+static QColor paintedOverlay(const QColor &base, const QColor &paint, QPainter::CompositionMode comp)
+{
+    QImage image(1, 1, QImage::Format_ARGB32_Premultiplied);
+    QPainter painter(&image);
+    QColor start = base;
+    start.setAlpha(255);
+    painter.fillRect(0, 0, 1, 1, start);
+    painter.setCompositionMode(comp);
+    painter.fillRect(0, 0, 1, 1, paint);
+    painter.end();
+    return image.pixel(0, 0);
+}
+
+void tst_KColorUtils::testOverlayModes()
+{
+    // Every 8-bit value is in one of the channels of these base colors
+    QImage bases(86, 1, QImage::Format_ARGB32_Premultiplied);
+    for (int x = 0; x < bases.width(); ++x) {
+        bases.setPixel(x, 0, qRgb(3 * x, qMin(3 * x + 1, 255), qMin(3 * x + 2, 255)));
+    }
+
+    // Paint every 8-bit color value with every alpha over each of them, and
+    // compare with what the raster paint engine gives
+    QImage image(bases.size(), bases.format());
+    for (int mode = QPainter::CompositionMode_SourceOver; mode <= QPainter::CompositionMode_Exclusion; ++mode) {
+        const auto comp = QPainter::CompositionMode(mode);
+        for (int alpha = 0; alpha < 256; ++alpha) {
+            for (int value = 0; value < 256; ++value) {
+                const QColor paint(value, value, value, alpha);
+                memcpy(image.bits(), bases.constBits(), bases.sizeInBytes());
+                QPainter painter(&image);
+                painter.setCompositionMode(comp);
+                painter.fillRect(image.rect(), paint);
+                painter.end();
+
+                for (int x = 0; x < bases.width(); ++x) {
+                    const QColor overlay = KColorUtils::overlayColors(QColor(bases.pixel(x, 0)), paint, comp);
+                    if (overlay != QColor(image.pixel(x, 0))) {
+                        QFAIL(qPrintable(QStringLiteral("mode %1, base %2, paint %3: %4 instead of %5")
+                                             .arg(mode)
+                                             .arg(bases.pixel(x, 0), 8, 16)
+                                             .arg(paint.rgba(), 8, 16)
+                                             .arg(overlay.rgb(), 8, 16)
+                                             .arg(image.pixel(x, 0), 8, 16)));
+                    }
+                }
+            }
+        }
+    }
+
+    // Colors with 16-bit channels, and the raster operations that QPainter still does
+    quint32 seed = 1;
+    const auto random16 = [&seed] {
+        seed = seed * 1664525 + 1013904223;
+        return quint16(seed >> 16);
+    };
+    for (int i = 0; i < 10000; ++i) {
+        const QColor base = QColor::fromRgba64(random16(), random16(), random16());
+        const QColor paint = QColor::fromRgba64(random16(), random16(), random16(), i % 4 ? random16() : 65535);
+        const auto comp = QPainter::CompositionMode(i % (QPainter::RasterOp_NotDestination + 1));
+        QCOMPARE(KColorUtils::overlayColors(base, paint, comp), paintedOverlay(base, paint, comp));
+    }
+}
+
 /* clang-format off */
 #define compareColors(c1, c2) \
     if (c1 != c2) { \
@@ -107,6 +177,54 @@ void tst_KColorUtils::testHCY()
     }
 }
 
+void tst_KColorUtils::testHCYF()
+{
+    for (int r = 0; r < 256; r += 5) {
+        for (int g = 0; g < 256; g += 5) {
+            for (int b = 0; b < 256; b += 5) {
+                const QRgb color = qRgba(r, g, b, (r + g + b) % 256);
+                QCOMPARE(KColorSpaces::KHCYF(color).rgba(), color);
+            }
+        }
+    }
+
+    // Single precision loses a bit on channels close to 0, which 8 bits can't
+    // tell apart anyway
+    quint32 seed = 1;
+    for (int i = 0; i < 100000; ++i) {
+        quint16 channels[4];
+        for (quint16 &channel : channels) {
+            seed = seed * 1664525 + 1013904223;
+            channel = seed >> 16;
+        }
+        const QRgba64 color = qRgba64(channels[0], channels[1], channels[2], channels[3]);
+        const QRgba64 result = KColorSpaces::KHCYF(color).rgba64();
+        QVERIFY(qAbs(result.red() - color.red()) <= 64);
+        QVERIFY(qAbs(result.green() - color.green()) <= 64);
+        QVERIFY(qAbs(result.blue() - color.blue()) <= 64);
+        QCOMPARE(result.alpha(), color.alpha());
+    }
+}
+
+void tst_KColorUtils::testGamma()
+{
+    // Every 16-bit channel value, and then some
+    qreal maxError = 0.0;
+    for (int i = 0; i <= 4 * USHRT_MAX; ++i) {
+        const qreal n = i / (4.0 * USHRT_MAX);
+        maxError = qMax(maxError, qAbs(fastIgamma(n) - pow(n, 1.0 / 2.2)));
+    }
+    for (qreal n = 1e-3; n > 1e-30; n *= 0.9) {
+        maxError = qMax(maxError, qAbs(fastIgamma(n) - pow(n, 1.0 / 2.2)));
+    }
+    QVERIFY2(maxError <= igammaMaxError, qPrintable(QString::number(maxError)));
+
+    QCOMPARE(fastIgamma(0.0), 0.0);
+    QCOMPARE(fastIgamma(-1.0), 0.0);
+    QCOMPARE(fastIgamma(2.0), fastIgamma(1.0));
+    QVERIFY(qAbs(fastIgamma(1.0) - 1.0) < 1e-15);
+}
+
 void tst_KColorUtils::testContrast()
 {
     QCOMPARE(KColorUtils::contrastRatio(Qt::black, Qt::white), qreal(21.0));
@@ -126,6 +244,62 @@ void checkIsGray(const QColor &color, int line)
     QTest::qCompare(hcy.c, qreal(0.0), "hcy.c", "0.0", __FILE__, line);
 }
 
+void tst_KColorUtils::testEnsureContrast()
+{
+    QList<QColor> colors;
+    for (const char *name :
+         {"#fcfcfc", "#eff0f1", "#bdc3c7", "#7f8c8d", "#31363b", "#232629", "#3daee9", "#2980b9", "#da4453", "#27ae60", "#f67400", "#fdbc4b"}) {
+        colors << QColor(QLatin1String(name));
+    }
+
+    const auto reachable = [](const QColor &background, qreal minRatio) {
+        const qreal bgLuma = KColorUtils::luma(background);
+        return minRatio * (bgLuma + 0.05) - 0.05 <= 1.0 || (bgLuma + 0.05) / minRatio - 0.05 >= 0.0;
+    };
+
+    std::vector<QRgb> foregrounds;
+    std::vector<QRgb> backgrounds;
+    for (qreal minRatio : {3.0, 4.5, 7.0}) {
+        for (const QColor &foreground : std::as_const(colors)) {
+            for (const QColor &background : std::as_const(colors)) {
+                foregrounds.push_back(foreground.rgb());
+                backgrounds.push_back(background.rgb());
+
+                const QColor result = KColorUtils::ensureContrast(foreground, background, minRatio);
+                const qreal ratio = KColorUtils::contrastRatio(result, background);
+                if (KColorUtils::contrastRatio(foreground, background) >= minRatio) {
+                    QCOMPARE(result, foreground);
+                } else if (reachable(background, minRatio)) {
+                    const QString message = QStringLiteral("%1 %2 %3").arg(foreground.name(), background.name()).arg(ratio);
+                    QVERIFY2(ratio >= minRatio && ratio < minRatio + 0.01, qPrintable(message));
+                } else {
+                    QVERIFY(result == Qt::black || result == Qt::white);
+                }
+            }
+        }
+
+        std::vector<QRgb> results(foregrounds.size());
+        KColorUtils::ensureContrast(foregrounds.data(), backgrounds.data(), results.data(), foregrounds.size(), minRatio);
+        for (size_t i = 0; i < results.size(); ++i) {
+            const QColor background(backgrounds[i]);
+            const qreal ratio = KColorUtils::contrastRatio(QColor(results[i]), background);
+            if (KColorUtils::contrastRatio(QColor(foregrounds[i]), background) >= minRatio) {
+                QCOMPARE(results[i], foregrounds[i]);
+            } else if (reachable(background, minRatio)) {
+                QVERIFY(ratio >= minRatio && ratio < minRatio * 1.05);
+            }
+        }
+        foregrounds.clear();
+        backgrounds.clear();
+    }
+
+    // Gray can't reach 7:1 in either direction, black contrasts more
+    QCOMPARE(KColorUtils::ensureContrast(QColor(0x3d, 0xae, 0xe9), QColor(0x80, 0x80, 0x80), 7.0), QColor(Qt::black));
+
+    // Alpha is kept
+    QCOMPARE(KColorUtils::ensureContrast(QColor(0x80, 0x80, 0x80, 0x40), Qt::white, 4.5).alpha(), 0x40);
+}
+
 void tst_KColorUtils::testShading()
 {
     const QColor testGray(128, 128, 128); // Qt::gray isn't pure gray!
@@ -148,6 +322,249 @@ void tst_KColorUtils::testShading()
     checkIsGray(KColorUtils::lighten(Qt::white, -0.1), __LINE__);
 }
 
+static qreal ratioForLuma(qreal y1, qreal y2)
+{
+    return (qMax(y1, y2) + 0.05) / (qMin(y1, y2) + 0.05);
+}
+
+// The contrast ratio to base that tint() gets with the given amount of color
+static qreal tintRatio(const QColor &base, const QColor &color, qreal amount)
+{
+    const qreal baseLuma = KColorUtils::luma(base);
+    const qreal mixLuma = KColorUtils::luma(KColorUtils::mix(base, color, pow(amount, 0.3)));
+    return ratioForLuma(baseLuma, baseLuma + (mixLuma - baseLuma) * amount);
+}
+
+// tint() as it used to be, bisecting for the amount of color with the goal ratio
+static QColor bisectedTint(const QColor &base, const QColor &color, qreal amount, qreal *goal)
+{
+    const qreal baseLuma = KColorUtils::luma(base);
+    *goal = 1.0 + ((ratioForLuma(baseLuma, KColorUtils::luma(color)) + 1.0) * amount * amount * amount);
+
+    double u = 1.0;
+    double l = 0.0;
+    double a = 0.5;
+    for (int i = 12; i; --i) {
+        a = 0.5 * (l + u);
+        if (tintRatio(base, color, a) > *goal) {
+            u = a;
+        } else {
+            l = a;
+        }
+    }
+
+    KColorSpaces::KHCY result(KColorUtils::mix(base, color, pow(a, 0.3)));
+    result.y = baseLuma + (result.y - baseLuma) * a;
+    return result.qColor();
+}
+
+void tst_KColorUtils::testTint()
+{
+    QList<QColor> colors;
+    for (const char *name : {"#fcfcfc", "#eff0f1", "#31363b", "#232629", "#3daee9", "#2980b9", "#da4453", "#27ae60", "#f67400", "#fdbc4b", "#9b59b6"}) {
+        colors << QColor(QLatin1String(name));
+    }
+    for (int i = 0; i < 64; ++i) {
+        colors << QColor((i & 3) * 85, (i >> 2 & 3) * 85, (i >> 4) * 85);
+    }
+
+    QCOMPARE(KColorUtils::tint(colors[0], colors[4], 0.0), colors[0]);
+    QCOMPARE(KColorUtils::tint(colors[0], colors[4], 1.0), colors[4]);
+
+    for (const QColor &base : std::as_const(colors)) {
+        for (const QColor &color : std::as_const(colors)) {
+            for (qreal amount : {0.01, 0.1, 0.2, 0.3, 0.5, 0.9}) {
+                qreal goal;
+                const QColor expected = bisectedTint(base, color, amount, &goal);
+                const QColor tinted = KColorUtils::tint(base, color, amount);
+                if (tinted == expected) {
+                    continue;
+                }
+
+                // Where the ratio crosses the goal several times, the bisection
+                // may have settled on another crossing
+                int crossings = 0;
+                bool above = false;
+                for (int step = 1; step <= 2048; ++step) {
+                    const bool stepAbove = step == 2048 || tintRatio(base, color, step / 2048.0) > goal;
+                    crossings += stepAbove != above;
+                    above = stepAbove;
+                }
+                QVERIFY2(crossings > 1, qPrintable(QStringLiteral("%1 %2 %3").arg(base.name(), color.name()).arg(amount)));
+            }
+        }
+    }
+}
+
+void tst_KColorUtils::testBatch()
+{
+    // Runs of the same color, and all kinds of alpha values
+    std::vector<QRgb> colors;
+    quint32 seed = 1;
+    for (int i = 0; i < 1000; ++i) {
+        seed = seed * 1664525 + 1013904223;
+        colors.insert(colors.end(), 1 + (seed >> 30), seed);
+    }
+    colors.push_back(qRgba(0, 0, 0, 0));
+    colors.push_back(qRgba(255, 255, 255, 255));
+    std::vector<QRgb> reversed(colors.rbegin(), colors.rend());
+
+    // The batch versions work in single precision, see KHCYF
+    std::vector<float> lumas(colors.size());
+    KColorUtils::luma(colors.data(), lumas.data(), colors.size());
+    for (size_t i = 0; i < colors.size(); ++i) {
+        QVERIFY(qAbs(lumas[i] - KColorUtils::luma(QColor::fromRgba(colors[i]))) < 1e-6);
+    }
+
+    const auto closeColors = [](QRgb c1, QRgb c2) {
+        return qAbs(qRed(c1) - qRed(c2)) <= 1 && qAbs(qGreen(c1) - qGreen(c2)) <= 1 && qAbs(qBlue(c1) - qBlue(c2)) <= 1 && qAlpha(c1) == qAlpha(c2);
+    };
+
+    std::vector<QRgb> results(colors.size());
+    KColorUtils::lighten(colors.data(), results.data(), colors.size(), 0.3, 0.8);
+    for (size_t i = 0; i < colors.size(); ++i) {
+        QVERIFY(closeColors(results[i], KColorUtils::lighten(QColor::fromRgba(colors[i]), 0.3, 0.8).rgba()));
+    }
+
+    KColorUtils::darken(colors.data(), results.data(), colors.size(), 0.4);
+    for (size_t i = 0; i < colors.size(); ++i) {
+        QVERIFY(closeColors(results[i], KColorUtils::darken(QColor::fromRgba(colors[i]), 0.4).rgba()));
+    }
+
+    KColorUtils::shade(colors.data(), results.data(), colors.size(), -0.2, 0.1);
+    for (size_t i = 0; i < colors.size(); ++i) {
+        QVERIFY(closeColors(results[i], KColorUtils::shade(QColor::fromRgba(colors[i]), -0.2, 0.1).rgba()));
+    }
+
+    for (qreal bias : {-1.0, 0.0, 0.25, 0.5, 0.9, 1.0}) {
+        KColorUtils::mix(colors.data(), reversed.data(), results.data(), colors.size(), bias);
+        for (size_t i = 0; i < colors.size(); ++i) {
+            QCOMPARE(results[i], KColorUtils::mix(QColor::fromRgba(colors[i]), QColor::fromRgba(reversed[i]), bias).rgba());
+        }
+    }
+
+    // In place
+    std::vector<QRgb> inPlace = colors;
+    KColorUtils::darken(inPlace.data(), inPlace.data(), inPlace.size(), 0.4);
+    KColorUtils::darken(colors.data(), results.data(), colors.size(), 0.4);
+    QCOMPARE(inPlace, results);
+}
+
+void tst_KColorUtils::testRecolorImage()
+{
+    // Large enough to be split among threads, with runs of the same color
+    QImage image(128, 160, QImage::Format_ARGB32_Premultiplied);
+    quint32 seed = 1;
+    for (int y = 0; y < image.height(); ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+        for (int x = 0; x < image.width(); ++x) {
+            if (x % 4 == 0) {
+                seed = seed * 1664525 + 1013904223;
+            }
+            line[x] = qPremultiply(seed);
+        }
+    }
+
+    using KColorUtils::RecolorOperation;
+    const QColor accent(0x3d, 0xae, 0xe9);
+    const std::pair<RecolorOperation, KColorUtils::RecolorParameters> cases[] = {
+        {RecolorOperation::Lighten, {QColor(), 0.3, 0.8}},
+        {RecolorOperation::Darken, {QColor(), 0.4, std::nullopt}},
+        {RecolorOperation::Shade, {QColor(), -0.2, 0.1}},
+        {RecolorOperation::Tint, {accent, 0.4, std::nullopt}},
+        {RecolorOperation::Mix, {accent, 0.7, std::nullopt}},
+    };
+    for (const auto &[operation, parameters] : cases) {
+        QImage recolored = image;
+        KColorUtils::recolorImage(recolored, operation, parameters);
+        QCOMPARE(recolored.format(), QImage::Format_ARGB32_Premultiplied);
+
+        for (int y = 0; y < image.height(); ++y) {
+            const QRgb *line = reinterpret_cast<const QRgb *>(image.constScanLine(y));
+            const QRgb *recoloredLine = reinterpret_cast<const QRgb *>(recolored.constScanLine(y));
+            for (int x = 0; x < image.width(); ++x) {
+                const QColor color = QColor::fromRgba(qUnpremultiply(line[x]));
+                QColor paint = accent;
+                paint.setAlpha(color.alpha());
+
+                QColor expected;
+                switch (operation) {
+                case RecolorOperation::Lighten:
+                    expected = KColorUtils::lighten(color, 0.3, 0.8);
+                    break;
+                case RecolorOperation::Darken:
+                    expected = KColorUtils::darken(color, 0.4);
+                    break;
+                case RecolorOperation::Shade:
+                    expected = KColorUtils::shade(color, -0.2, 0.1);
+                    break;
+                case RecolorOperation::Tint:
+                    expected = KColorUtils::tint(color, paint, 0.4);
+                    break;
+                case RecolorOperation::Mix:
+                    expected = KColorUtils::mix(color, paint, 0.7);
+                    break;
+                }
+
+                // Lighten, Darken and Shade work in single precision
+                const QRgb result = recoloredLine[x];
+                const QRgb expectedResult = qPremultiply(expected.rgba());
+                QVERIFY2(qAbs(qRed(result) - qRed(expectedResult)) <= 1 && qAbs(qGreen(result) - qGreen(expectedResult)) <= 1
+                             && qAbs(qBlue(result) - qBlue(expectedResult)) <= 1 && qAlpha(result) == qAlpha(expectedResult),
+                         qPrintable(QStringLiteral("%1 %2 %3").arg(int(operation)).arg(result, 8, 16).arg(expectedResult, 8, 16)));
+            }
+        }
+    }
+
+    // Other formats are converted
+    QImage rgb(4, 4, QImage::Format_RGB888);
+    rgb.fill(accent);
+    KColorUtils::recolorImage(rgb, RecolorOperation::Darken, {QColor(), 0.4, std::nullopt});
+    QCOMPARE(rgb.format(), QImage::Format_RGB32);
+    QRgb expected = accent.rgb();
+    KColorUtils::darken(&expected, &expected, 1, 0.4);
+    QCOMPARE(rgb.pixel(3, 3), expected);
+}
+
+void tst_KColorUtils::testCache()
+{
+    const QColor base(0x31, 0x36, 0x3b);
+    const QColor accent(0x3d, 0xae, 0xe9);
+    const QColor tinted = KColorUtils::tint(base, accent, 0.2);
+    const QColor mixed = KColorUtils::mix(base, accent, 0.4);
+    const QColor lighter = KColorUtils::lighten(accent, 0.3, 0.7);
+
+    KColorUtils::setCacheSize(2);
+    KColorUtils::resetCacheStatistics();
+    QCOMPARE(KColorUtils::cacheSize(), 2);
+
+    QCOMPARE(KColorUtils::tint(base, accent, 0.2), tinted);
+    QCOMPARE(KColorUtils::tint(base, accent, 0.2), tinted);
+    QCOMPARE(KColorUtils::mix(base, accent, 0.4), mixed);
+    QCOMPARE(KColorUtils::mix(base, accent, 0.4), mixed);
+    QCOMPARE(KColorUtils::cacheStatistics().hits, 2LL);
+    QCOMPARE(KColorUtils::cacheStatistics().misses, 2LL);
+
+    // Different arguments, and the least recently used color is dropped
+    QCOMPARE(KColorUtils::lighten(accent, 0.3, 0.7), lighter);
+    QVERIFY(KColorUtils::darken(accent, 0.3, 0.7) != lighter);
+    QCOMPARE(KColorUtils::tint(base, accent, 0.2), tinted);
+    QCOMPARE(KColorUtils::cacheStatistics().hits, 2LL);
+    QCOMPARE(KColorUtils::cacheStatistics().misses, 5LL);
+
+    // The colors are returned as they were passed, so only RGB colors are cached
+    const QColor hsv = base.toHsv();
+    QCOMPARE(KColorUtils::mix(hsv, accent, 0.0).spec(), QColor::Hsv);
+    QCOMPARE(KColorUtils::mix(base, accent, 0.0).spec(), QColor::Rgb);
+    QCOMPARE(KColorUtils::cacheStatistics().misses, 6LL);
+
+    KColorUtils::resetCacheStatistics();
+    KColorUtils::setCacheSize(0);
+    QCOMPARE(KColorUtils::tint(base, accent, 0.2), tinted);
+    QCOMPARE(KColorUtils::cacheStatistics().hits, 0LL);
+    QCOMPARE(KColorUtils::cacheStatistics().misses, 0LL);
+}
+
 QTEST_MAIN(tst_KColorUtils)
 
 #include "moc_kcolorutilstest.cpp"
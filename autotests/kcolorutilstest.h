@@ -8,10 +8,18 @@ class tst_KColorUtils : public QObject
     Q_OBJECT
 private Q_SLOTS:
     void testOverlay();
+    void testOverlayModes();
     void testMix();
     void testHCY();
+    void testHCYF();
+    void testGamma();
     void testContrast();
+    void testEnsureContrast();
     void testShading();
+    void testTint();
+    void testBatch();
+    void testRecolorImage();
+    void testCache();
 };
 
 #endif // KCOLORUTILSTEST_H
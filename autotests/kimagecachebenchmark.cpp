@@ -0,0 +1,296 @@
+/*
+    SPDX-FileCopyrightText: 2026 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+#include <KImageCache>
+
+#include <QDeadlineTimer>
+#include <QGuiApplication>
+#include <QPainter>
+#include <QProcess>
+#include <QStandardPaths>
+#include <QTest>
+
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace Qt::Literals::StringLiterals;
+
+static const QString cacheName = u"kimagecachebenchmark"_s;
+static constexpr unsigned cacheSize = 256 * 1024 * 1024;
+
+// Set in the environment of the processes that use the cache concurrently to the benchmark
+static const char workerVariable[] = "KIMAGECACHEBENCHMARK_WORKER";
+
+static QImage benchmarkImage(const QSize &size, int seed = 0)
+{
+    QImage image(size, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+
+    // Something resembling an icon: flat areas, gradients and antialiased edges
+    QPainter painter(&image);
+    painter.setRenderHint(QPainter::Antialiasing);
+    QLinearGradient gradient(0, 0, size.width(), size.height());
+    gradient.setColorAt(0, QColor::fromHsv(seed * 37 % 360, 200, 220));
+    gradient.setColorAt(1, QColor::fromHsv((seed * 37 + 120) % 360, 200, 120, 200));
+    painter.setBrush(gradient);
+    painter.setPen(QPen(Qt::black, qMax(1, size.width() / 32)));
+    painter.drawRoundedRect(QRectF(QPointF(0, 0), size).adjusted(2, 2, -2, -2), size.width() / 8.0, size.height() / 8.0);
+    painter.end();
+
+    return image;
+}
+
+static void addSizeRows(const char *prefix, const std::function<void(QTestData &)> &addColumns = {})
+{
+    const QList<QSize> sizes = {QSize(16, 16), QSize(64, 64), QSize(256, 256), QSize(1024, 1024), QSize(3840, 2160)};
+    for (const QSize &size : sizes) {
+        QTestData &row = QTest::addRow("%s%dx%d", prefix, size.width(), size.height()) << size;
+        if (addColumns) {
+            addColumns(row);
+        }
+    }
+}
+
+/*
+ * Looks up and inserts small images in the cache, to measure the impact of
+ * other processes using the same cache. Runs until the benchmark closes its
+ * standard input, which also happens when the benchmark crashes, and at most
+ * for a few minutes, so that no worker is left behind.
+ */
+static int runWorker()
+{
+    static std::atomic<bool> inputClosed = false;
+    std::thread([] {
+        while (std::getchar() != EOF) { }
+        inputClosed = true;
+    }).detach();
+
+    KImageCache cache(cacheName, cacheSize);
+    const QImage image = benchmarkImage(QSize(64, 64), 1);
+    const QDeadlineTimer deadline(std::chrono::minutes(5));
+
+    for (int i = 0; !inputClosed && !deadline.hasExpired(); i = (i + 1) % 256) {
+        const QString key = u"worker-%1"_s.arg(i);
+        if (!cache.findImage(key, nullptr)) {
+            cache.insertImage(key, image);
+        }
+    }
+    return 0;
+}
+
+class KImageCacheBenchmark : public QObject
+{
+    Q_OBJECT
+private:
+    std::unique_ptr<KImageCache> m_cache;
+    std::vector<std::unique_ptr<QProcess>> m_workers;
+
+    void startWorkers(int count)
+    {
+        for (int i = 0; i < count; ++i) {
+            auto worker = std::make_unique<QProcess>();
+            QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+            environment.insert(QString::fromLatin1(workerVariable), u"1"_s);
+            worker->setProcessEnvironment(environment);
+            worker->setProcessChannelMode(QProcess::ForwardedChannels);
+            worker->start(QCoreApplication::applicationFilePath(), {});
+            QVERIFY(worker->waitForStarted());
+            m_workers.push_back(std::move(worker));
+        }
+    }
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+        QStandardPaths::setTestModeEnabled(true);
+    }
+
+    void init()
+    {
+        KSharedDataCache::deleteCache(cacheName);
+        m_cache = std::make_unique<KImageCache>(cacheName, cacheSize);
+    }
+
+    void cleanup()
+    {
+        for (const auto &worker : m_workers) {
+            worker->closeWriteChannel();
+        }
+        for (const auto &worker : m_workers) {
+            if (!worker->waitForFinished()) {
+                worker->kill();
+                worker->waitForFinished();
+            }
+        }
+        m_workers.clear();
+
+        m_cache.reset();
+        KSharedDataCache::deleteCache(cacheName);
+    }
+
+    void benchInsertImage_data()
+    {
+        QTest::addColumn<QSize>("size");
+        QTest::addColumn<KImageCache::StorageFormat>("storageFormat");
+
+        addSizeRows("png-", [](QTestData &row) {
+            row << KImageCache::StorageFormat::Png;
+        });
+        addSizeRows("raw-", [](QTestData &row) {
+            row << KImageCache::StorageFormat::Raw;
+        });
+        addSizeRows("qoi-", [](QTestData &row) {
+            row << KImageCache::StorageFormat::Qoi;
+        });
+    }
+
+    void benchInsertImage()
+    {
+        QFETCH(QSize, size);
+        QFETCH(KImageCache::StorageFormat, storageFormat);
+
+        m_cache->setStorageFormat(storageFormat);
+        const QImage image = benchmarkImage(size);
+
+        QBENCHMARK {
+            QVERIFY(m_cache->insertImage(u"image"_s, image));
+        }
+    }
+
+    void benchFindImage_data()
+    {
+        benchInsertImage_data();
+    }
+
+    void benchFindImage()
+    {
+        QFETCH(QSize, size);
+        QFETCH(KImageCache::StorageFormat, storageFormat);
+
+        m_cache->setStorageFormat(storageFormat);
+        QVERIFY(m_cache->insertImage(u"image"_s, benchmarkImage(size)));
+
+        QImage image;
+        QBENCHMARK {
+            QVERIFY(m_cache->findImage(u"image"_s, &image));
+        }
+        QCOMPARE(image.size(), size);
+    }
+
+    void benchFindPixmap_data()
+    {
+        QTest::addColumn<QSize>("size");
+        QTest::addColumn<bool>("pixmapCaching");
+
+        addSizeRows("cached-", [](QTestData &row) {
+            row << true;
+        });
+        addSizeRows("uncached-", [](QTestData &row) {
+            row << false;
+        });
+    }
+
+    void benchFindPixmap()
+    {
+        QFETCH(QSize, size);
+        QFETCH(bool, pixmapCaching);
+
+        m_cache->setPixmapCaching(pixmapCaching);
+        QVERIFY(m_cache->insertImage(u"pixmap"_s, benchmarkImage(size)));
+
+        QPixmap pixmap;
+        QBENCHMARK {
+            QVERIFY(m_cache->findPixmap(u"pixmap"_s, &pixmap));
+        }
+        QCOMPARE(pixmap.size(), size);
+    }
+
+    void benchHitRatio_data()
+    {
+        QTest::addColumn<int>("hitPercentage");
+
+        QTest::newRow("0%") << 0;
+        QTest::newRow("50%") << 50;
+        QTest::newRow("90%") << 90;
+        QTest::newRow("100%") << 100;
+    }
+
+    void benchHitRatio()
+    {
+        QFETCH(int, hitPercentage);
+
+        // Pixmap caching would answer all but the first lookups locally
+        m_cache->setPixmapCaching(false);
+
+        QStringList keys;
+        for (int i = 0; i < 100; ++i) {
+            const QString key = u"icon-%1"_s.arg(i);
+            if (i < hitPercentage) {
+                QVERIFY(m_cache->insertImage(key, benchmarkImage(QSize(64, 64), i)));
+            }
+            keys << key;
+        }
+
+        QPixmap pixmap;
+        QBENCHMARK {
+            for (const QString &key : std::as_const(keys)) {
+                m_cache->findPixmap(key, &pixmap);
+            }
+        }
+    }
+
+    void benchConcurrentProcesses_data()
+    {
+        QTest::addColumn<int>("workers");
+
+        QTest::newRow("alone") << 0;
+        QTest::newRow("1 other process") << 1;
+        QTest::newRow("3 other processes") << 3;
+    }
+
+    void benchConcurrentProcesses()
+    {
+        QFETCH(int, workers);
+
+        m_cache->setPixmapCaching(false);
+        m_cache->setStorageFormat(KImageCache::StorageFormat::Raw);
+
+        QStringList keys;
+        for (int i = 0; i < 100; ++i) {
+            keys << u"icon-%1"_s.arg(i);
+            QVERIFY(m_cache->insertImage(keys.last(), benchmarkImage(QSize(64, 64), i)));
+        }
+
+        startWorkers(workers);
+
+        QImage image;
+        QBENCHMARK {
+            for (const QString &key : std::as_const(keys)) {
+                m_cache->findImage(key, &image);
+            }
+        }
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    if (qEnvironmentVariableIsSet(workerVariable)) {
+        QCoreApplication app(argc, argv);
+        QStandardPaths::setTestModeEnabled(true);
+        return runWorker();
+    }
+
+    QGuiApplication app(argc, argv);
+    KImageCacheBenchmark benchmark;
+    QTEST_SET_MAIN_SOURCE_PATH
+    return QTest::qExec(&benchmark, argc, argv);
+}
+
+#include "kimagecachebenchmark.moc"
@@ -0,0 +1,700 @@
+/*
+    SPDX-FileCopyrightText: 2026 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+#include <KImageCache>
+
+#include <QFile>
+#include <QPainter>
+#include <QStandardPaths>
+#include <QTest>
+
+using namespace Qt::Literals::StringLiterals;
+
+static QImage testImage(QImage::Format format, const QSize &size = QSize(37, 21))
+{
+    QImage image(size, QImage::Format_ARGB32);
+    image.fill(Qt::transparent);
+
+    QPainter painter(&image);
+    painter.fillRect(0, 0, size.width() / 2, size.height(), QColor(255, 0, 0, 128));
+    painter.fillRect(size.width() / 2, 0, size.width() - size.width() / 2, size.height() / 2, Qt::blue);
+    painter.end();
+
+    return image.convertToFormat(format);
+}
+
+class KImageCacheTest : public QObject
+{
+    Q_OBJECT
+private:
+    std::unique_ptr<KImageCache> m_cache;
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+        QStandardPaths::setTestModeEnabled(true);
+    }
+
+    void init()
+    {
+        KSharedDataCache::deleteCache(u"kimagecachetest"_s);
+        QFile::remove(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + u"/kimagecachetest.kcache-invalidations"_s);
+        m_cache = std::make_unique<KImageCache>(u"kimagecachetest"_s, 4 * 1024 * 1024);
+    }
+
+    void cleanup()
+    {
+        m_cache.reset();
+        KSharedDataCache::deleteCache(u"kimagecachetest"_s);
+    }
+
+    void testRoundTrip_data()
+    {
+        QTest::addColumn<KImageCache::StorageFormat>("storageFormat");
+        QTest::addColumn<QImage::Format>("imageFormat");
+        QTest::addColumn<QImage::Format>("expectedFormat");
+
+        QTest::newRow("png") << KImageCache::StorageFormat::Png << QImage::Format_ARGB32_Premultiplied << QImage::Format_ARGB32;
+        QTest::newRow("raw-argb32-premultiplied") << KImageCache::StorageFormat::Raw << QImage::Format_ARGB32_Premultiplied
+                                                  << QImage::Format_ARGB32_Premultiplied;
+        QTest::newRow("raw-argb32") << KImageCache::StorageFormat::Raw << QImage::Format_ARGB32 << QImage::Format_ARGB32_Premultiplied;
+        QTest::newRow("raw-rgb888") << KImageCache::StorageFormat::Raw << QImage::Format_RGB888 << QImage::Format_RGB888;
+        QTest::newRow("raw-indexed8") << KImageCache::StorageFormat::Raw << QImage::Format_Indexed8 << QImage::Format_ARGB32_Premultiplied;
+        QTest::newRow("qoi-argb32-premultiplied") << KImageCache::StorageFormat::Qoi << QImage::Format_ARGB32_Premultiplied
+                                                  << QImage::Format_ARGB32_Premultiplied;
+        QTest::newRow("qoi-argb32") << KImageCache::StorageFormat::Qoi << QImage::Format_ARGB32 << QImage::Format_ARGB32_Premultiplied;
+        QTest::newRow("qoi-rgb32") << KImageCache::StorageFormat::Qoi << QImage::Format_RGB32 << QImage::Format_RGB32;
+        QTest::newRow("qoi-rgb888") << KImageCache::StorageFormat::Qoi << QImage::Format_RGB888 << QImage::Format_RGB32;
+    }
+
+    void testRoundTrip()
+    {
+        QFETCH(KImageCache::StorageFormat, storageFormat);
+        QFETCH(QImage::Format, imageFormat);
+        QFETCH(QImage::Format, expectedFormat);
+
+        m_cache->setStorageFormat(storageFormat);
+        QCOMPARE(m_cache->storageFormat(), storageFormat);
+
+        const QImage image = testImage(imageFormat);
+        QVERIFY(m_cache->insertImage(u"image"_s, image));
+
+        QImage found;
+        QVERIFY(m_cache->findImage(u"image"_s, &found));
+        QCOMPARE(found.format(), expectedFormat);
+        QCOMPARE(found.size(), image.size());
+        QCOMPARE(found.convertToFormat(QImage::Format_ARGB32), image.convertToFormat(QImage::Format_ARGB32));
+
+        QVERIFY(!m_cache->findImage(u"missing"_s, &found));
+    }
+
+    void testRawKeepsDevicePixelRatio()
+    {
+        m_cache->setStorageFormat(KImageCache::StorageFormat::Raw);
+
+        QImage image = testImage(QImage::Format_ARGB32_Premultiplied, QSize(64, 64));
+        image.setDevicePixelRatio(2.0);
+        QVERIFY(m_cache->insertImage(u"image"_s, image));
+
+        QImage found;
+        QVERIFY(m_cache->findImage(u"image"_s, &found));
+        QCOMPARE(found.devicePixelRatio(), 2.0);
+
+        // Don't let the local pixmap cache answer the lookup
+        m_cache->setPixmapCaching(false);
+        QPixmap pixmap;
+        QVERIFY(m_cache->findPixmap(u"image"_s, &pixmap));
+        QCOMPARE(pixmap.devicePixelRatio(), 2.0);
+        QCOMPARE(pixmap.size(), QSize(64, 64));
+    }
+
+    void testRawImageOutlivesCache()
+    {
+        m_cache->setStorageFormat(KImageCache::StorageFormat::Raw);
+
+        const QImage image = testImage(QImage::Format_ARGB32_Premultiplied);
+        QVERIFY(m_cache->insertImage(u"image"_s, image));
+
+        QImage found;
+        QVERIFY(m_cache->findImage(u"image"_s, &found));
+        const QImage copy = found;
+
+        cleanup();
+        QCOMPARE(found, image);
+
+        // Writing to the image must not affect other users of the same data
+        found.setPixel(0, 0, qRgb(0, 255, 0));
+        QCOMPARE(found.pixel(0, 0), qRgb(0, 255, 0));
+        QCOMPARE(copy, image);
+    }
+
+    void testBatch_data()
+    {
+        QTest::addColumn<KImageCache::StorageFormat>("storageFormat");
+
+        QTest::newRow("png") << KImageCache::StorageFormat::Png;
+        QTest::newRow("raw") << KImageCache::StorageFormat::Raw;
+        QTest::newRow("qoi") << KImageCache::StorageFormat::Qoi;
+    }
+
+    void testBatch()
+    {
+        QFETCH(KImageCache::StorageFormat, storageFormat);
+        m_cache->setStorageFormat(storageFormat);
+
+        QHash<QString, QImage> images;
+        for (int i = 1; i <= 10; ++i) {
+            images.insert(QString::number(i), testImage(QImage::Format_ARGB32_Premultiplied, QSize(i, i)));
+        }
+        QVERIFY(m_cache->insertImages(images));
+
+        const QStringList keys{u"1"_s, u"foo"_s, u"5"_s, u"bar"_s, u"10"_s};
+        QStringList missing;
+        const QHash<QString, QImage> found = m_cache->findImages(keys, &missing);
+        QCOMPARE(found.size(), 3);
+        QCOMPARE(missing, QStringList({u"foo"_s, u"bar"_s}));
+        for (auto it = found.cbegin(); it != found.cend(); ++it) {
+            QCOMPARE(it.value().convertToFormat(QImage::Format_ARGB32), images.value(it.key()).convertToFormat(QImage::Format_ARGB32));
+        }
+
+        missing.clear();
+        QVERIFY(m_cache->insertPixmap(u"pixmap"_s, QPixmap::fromImage(images.value(u"7"_s))));
+        const QHash<QString, QPixmap> pixmaps = m_cache->findPixmaps(QStringList{u"pixmap"_s, u"2"_s, u"foo"_s}, &missing);
+        QCOMPARE(pixmaps.size(), 2);
+        QCOMPARE(pixmaps.value(u"pixmap"_s).size(), QSize(7, 7));
+        QCOMPARE(pixmaps.value(u"2"_s).size(), QSize(2, 2));
+        QCOMPARE(missing, QStringList{u"foo"_s});
+    }
+
+    void testFindImageAsync_data()
+    {
+        QTest::addColumn<KImageCache::StorageFormat>("storageFormat");
+
+        QTest::newRow("png") << KImageCache::StorageFormat::Png;
+        QTest::newRow("raw") << KImageCache::StorageFormat::Raw;
+        QTest::newRow("qoi") << KImageCache::StorageFormat::Qoi;
+    }
+
+    void testFindImageAsync()
+    {
+        QFETCH(KImageCache::StorageFormat, storageFormat);
+        m_cache->setStorageFormat(storageFormat);
+
+        const QImage image = testImage(QImage::Format_ARGB32_Premultiplied, QSize(256, 256));
+        QVERIFY(m_cache->insertImage(u"image"_s, image));
+
+        QFuture<QImage> first = m_cache->findImageAsync(u"image"_s);
+        QFuture<QImage> second = m_cache->findImageAsync(u"image"_s);
+        QCOMPARE(first.result().convertToFormat(QImage::Format_ARGB32), image.convertToFormat(QImage::Format_ARGB32));
+        QCOMPARE(second.result().convertToFormat(QImage::Format_ARGB32), image.convertToFormat(QImage::Format_ARGB32));
+
+        QFuture<QImage> missing = m_cache->findImageAsync(u"missing"_s);
+        QVERIFY(missing.isFinished());
+        QVERIFY(missing.result().isNull());
+
+        // The decoded image ends up in the local pixmap cache as well, which
+        // insertImage() doesn't touch
+        QTest::qWait(100);
+        QVERIFY(m_cache->insertImage(u"image"_s, testImage(QImage::Format_ARGB32_Premultiplied, QSize(16, 16))));
+        QPixmap pixmap;
+        QVERIFY(m_cache->findPixmap(u"image"_s, &pixmap));
+        QCOMPARE(pixmap.size(), image.size());
+    }
+
+    void testFindImageAsyncAfterInsert()
+    {
+        const QImage image = testImage(QImage::Format_ARGB32_Premultiplied, QSize(256, 256));
+        const QImage replacement = testImage(QImage::Format_ARGB32_Premultiplied, QSize(16, 16));
+        QVERIFY(m_cache->insertImage(u"image"_s, image));
+
+        // The decode can only finish in the event loop, so it is still pending
+        QFuture<QImage> previous = m_cache->findImageAsync(u"image"_s);
+        QVERIFY(m_cache->insertImage(u"image"_s, replacement));
+        QFuture<QImage> current = m_cache->findImageAsync(u"image"_s);
+        QCOMPARE(previous.result().size(), image.size());
+        QCOMPARE(current.result().size(), replacement.size());
+
+        // Only the decode of the current image may end up in the local pixmap cache
+        QTRY_VERIFY(m_cache->pixmapCacheMemoryUsage() > 0);
+        QTest::qWait(100);
+        QCOMPARE(m_cache->pixmapCacheMemoryUsage(), 16 * 16 * 4LL);
+        QPixmap pixmap;
+        QVERIFY(m_cache->findPixmap(u"image"_s, &pixmap));
+        QCOMPARE(pixmap.size(), replacement.size());
+    }
+
+    void testPromotionThreshold()
+    {
+        QCOMPARE(m_cache->sharedCachePromotionThreshold(), 0);
+        m_cache->setSharedCachePromotionThreshold(3);
+        QCOMPARE(m_cache->sharedCachePromotionThreshold(), 3);
+
+        const QPixmap pixmap = QPixmap::fromImage(testImage(QImage::Format_ARGB32_Premultiplied));
+        QVERIFY(m_cache->insertPixmap(u"pixmap"_s, pixmap));
+
+        // Only used once so far, so it's only available locally
+        QPixmap found;
+        QVERIFY(!m_cache->findImage(u"pixmap"_s, nullptr));
+        QVERIFY(m_cache->findPixmap(u"pixmap"_s, &found));
+        QVERIFY(!m_cache->findImage(u"pixmap"_s, nullptr));
+        QVERIFY(m_cache->findPixmap(u"pixmap"_s, &found));
+        QVERIFY(m_cache->findImage(u"pixmap"_s, nullptr));
+        QCOMPARE(found.size(), pixmap.size());
+
+        // Without local caching, everything has to go to the shared cache
+        m_cache->setPixmapCaching(false);
+        QVERIFY(m_cache->insertPixmap(u"uncached"_s, pixmap));
+        QVERIFY(m_cache->findImage(u"uncached"_s, nullptr));
+    }
+
+    void testPromotionReplacesSharedImage()
+    {
+        m_cache->setSharedCachePromotionThreshold(3);
+        QVERIFY(m_cache->insertImage(u"image"_s, testImage(QImage::Format_ARGB32_Premultiplied, QSize(16, 16))));
+
+        // The updated pixmap hasn't been used often enough to be promoted, but
+        // the shared cache mustn't keep the previous image either
+        const QPixmap pixmap = QPixmap::fromImage(testImage(QImage::Format_ARGB32_Premultiplied, QSize(32, 32)));
+        QVERIFY(m_cache->insertPixmap(u"image"_s, pixmap));
+        QImage found;
+        QVERIFY(m_cache->findImage(u"image"_s, &found));
+        QCOMPARE(found.size(), pixmap.size());
+    }
+
+    void testStatistics()
+    {
+        const QImage image = testImage(QImage::Format_ARGB32_Premultiplied, QSize(64, 64));
+
+        QVERIFY(m_cache->insertImage(u"image"_s, image));
+        QVERIFY(m_cache->findImage(u"image"_s, nullptr));
+        QVERIFY(!m_cache->findImage(u"missing"_s, nullptr));
+        QVERIFY(m_cache->insertPixmap(u"pixmap"_s, QPixmap::fromImage(image)));
+        QVERIFY(m_cache->findPixmap(u"pixmap"_s, nullptr));
+
+        KImageCache::Statistics stats = m_cache->statistics();
+        QCOMPARE(stats.localHits, 1LL);
+        QCOMPARE(stats.sharedHits, 1LL);
+        QCOMPARE(stats.misses, 1LL);
+        QCOMPARE(stats.localEvictions, 0LL);
+        QVERIFY(stats.bytesInserted > 0);
+        QVERIFY(stats.encodeTime.count() > 0);
+
+        QImage found;
+        QVERIFY(m_cache->findImage(u"image"_s, &found));
+        QVERIFY(m_cache->statistics().decodeTime > stats.decodeTime);
+
+        // Each pixmap takes 16 KiB, so only one of them fits
+        QVERIFY(m_cache->insertPixmap(u"pixmap2"_s, QPixmap::fromImage(image)));
+        m_cache->setPixmapCacheLimit(20 * 1024);
+        QCOMPARE(m_cache->statistics().localEvictions, 1LL);
+
+        m_cache->resetStatistics();
+        stats = m_cache->statistics();
+        QCOMPARE(stats.localHits, 0LL);
+        QCOMPARE(stats.sharedHits, 0LL);
+        QCOMPARE(stats.misses, 0LL);
+        QCOMPARE(stats.localEvictions, 0LL);
+        QCOMPARE(stats.bytesInserted, 0LL);
+        QVERIFY(stats.encodeTime.count() == 0);
+        QVERIFY(stats.decodeTime.count() == 0);
+    }
+
+    void testVariants_data()
+    {
+        QTest::addColumn<KImageCache::StorageFormat>("storageFormat");
+
+        QTest::newRow("png") << KImageCache::StorageFormat::Png;
+        QTest::newRow("raw") << KImageCache::StorageFormat::Raw;
+        QTest::newRow("qoi") << KImageCache::StorageFormat::Qoi;
+    }
+
+    void testVariants()
+    {
+        QFETCH(KImageCache::StorageFormat, storageFormat);
+        m_cache->setStorageFormat(storageFormat);
+
+        const QImage normal = testImage(QImage::Format_ARGB32_Premultiplied, QSize(64, 64));
+        QImage hiDpi = testImage(QImage::Format_ARGB32_Premultiplied, QSize(96, 96));
+        hiDpi.setDevicePixelRatio(1.5);
+        QVERIFY(m_cache->insertImageVariant(u"icon"_s, normal));
+        QVERIFY(m_cache->insertImageVariant(u"icon"_s, hiDpi));
+
+        // Exact matches
+        QImage found;
+        QVERIFY(m_cache->findImageVariant(u"icon"_s, QSize(64, 64), 1.0, &found));
+        QCOMPARE(found.size(), QSize(64, 64));
+        QCOMPARE(found.devicePixelRatio(), 1.0);
+        QVERIFY(m_cache->findImageVariant(u"icon"_s, QSize(64, 64), 1.5, &found));
+        QCOMPARE(found.size(), QSize(96, 96));
+        QCOMPARE(found.devicePixelRatio(), 1.5);
+
+        // Same amount of pixels as the normal variant, so nothing needs to be scaled
+        QVERIFY(m_cache->findImageVariant(u"icon"_s, QSize(32, 32), 2.0, &found));
+        QCOMPARE(found.size(), QSize(64, 64));
+        QCOMPARE(found.devicePixelRatio(), 2.0);
+        QCOMPARE(found.pixel(0, 0), normal.pixel(0, 0));
+
+        // Scaled down from the smallest variant that is large enough
+        QVERIFY(m_cache->findImageVariant(u"icon"_s, QSize(24, 24), 1.0, &found));
+        QCOMPARE(found.size(), QSize(24, 24));
+        QVERIFY(m_cache->findImageVariant(u"icon"_s, QSize(40, 40), 2.0, &found));
+        QCOMPARE(found.size(), QSize(80, 80));
+        QCOMPARE(found.devicePixelRatio(), 2.0);
+
+        // Variants can't clash with ordinary keys
+        QVERIFY(m_cache->insertImage(u"icon@64x64@1x"_s, testImage(QImage::Format_ARGB32_Premultiplied, QSize(8, 8))));
+        QVERIFY(m_cache->findImageVariant(u"icon"_s, QSize(64, 64), 1.0, &found));
+        QCOMPARE(found.size(), QSize(64, 64));
+
+        // There is nothing large enough to scale down from
+        QVERIFY(!m_cache->findImageVariant(u"icon"_s, QSize(64, 64), 2.0, &found));
+        QVERIFY(!m_cache->findImageVariant(u"other"_s, QSize(16, 16), 1.0, &found));
+
+        QPixmap pixmap = QPixmap::fromImage(hiDpi);
+        QVERIFY(m_cache->insertPixmapVariant(u"pixmap"_s, pixmap));
+        QPixmap foundPixmap;
+        QVERIFY(m_cache->findPixmapVariant(u"pixmap"_s, QSize(64, 64), 1.5, &foundPixmap));
+        QCOMPARE(foundPixmap.devicePixelRatio(), 1.5);
+        QCOMPARE(foundPixmap.size(), QSize(96, 96));
+        QVERIFY(m_cache->findPixmapVariant(u"pixmap"_s, QSize(32, 32), 1.0, &foundPixmap));
+        QCOMPARE(foundPixmap.devicePixelRatio(), 1.0);
+        QCOMPARE(foundPixmap.size(), QSize(32, 32));
+    }
+
+    void testQoiCompresses()
+    {
+        const QImage image = testImage(QImage::Format_ARGB32_Premultiplied, QSize(256, 256));
+
+        m_cache->setStorageFormat(KImageCache::StorageFormat::Raw);
+        QVERIFY(m_cache->insertImage(u"raw"_s, image));
+        const qint64 rawSize = m_cache->statistics().bytesInserted;
+
+        m_cache->resetStatistics();
+        m_cache->setStorageFormat(KImageCache::StorageFormat::Qoi);
+        QVERIFY(m_cache->insertImage(u"qoi"_s, image));
+        QVERIFY(m_cache->statistics().bytesInserted < rawSize / 10);
+    }
+
+    void testQoiKeepsHighBitDepth()
+    {
+        m_cache->setStorageFormat(KImageCache::StorageFormat::Qoi);
+
+        // Channel values that don't fit into 8 bits
+        QImage image(32, 16, QImage::Format_RGBA64);
+        for (int y = 0; y < image.height(); ++y) {
+            for (int x = 0; x < image.width(); ++x) {
+                image.setPixelColor(x, y, QColor::fromRgba64(x * 2049 + 1, y * 4097 + 3, 12345, 65535));
+            }
+        }
+        QVERIFY(m_cache->insertImage(u"image"_s, image));
+
+        QImage found;
+        QVERIFY(m_cache->findImage(u"image"_s, &found));
+        QCOMPARE(found.format(), QImage::Format_RGBA64_Premultiplied);
+        QCOMPARE(found.convertToFormat(QImage::Format_RGBA64), image);
+    }
+
+    void testTrimLocalCache()
+    {
+        const QImage image = testImage(QImage::Format_ARGB32_Premultiplied, QSize(64, 64));
+        const int limit = m_cache->pixmapCacheLimit();
+
+        QVERIFY(m_cache->insertPixmap(u"a"_s, QPixmap::fromImage(image)));
+        QVERIFY(m_cache->insertPixmap(u"b"_s, QPixmap::fromImage(image)));
+        QVERIFY(m_cache->insertPixmap(u"c"_s, QPixmap::fromImage(image)));
+        QVERIFY(m_cache->findPixmap(u"a"_s, nullptr));
+
+        // Each pixmap takes 16 KiB, so only the most recently used one is kept
+        m_cache->resetStatistics();
+        m_cache->trimLocalCache(20 * 1024);
+        QCOMPARE(m_cache->statistics().localEvictions, 2LL);
+        QCOMPARE(m_cache->pixmapCacheLimit(), limit);
+
+        QVERIFY(m_cache->findPixmap(u"a"_s, nullptr));
+        QVERIFY(m_cache->findPixmap(u"b"_s, nullptr));
+        QCOMPARE(m_cache->statistics().localHits, 1LL);
+        QCOMPARE(m_cache->statistics().sharedHits, 1LL);
+
+        QVERIFY(!m_cache->trimOnMemoryPressure());
+        m_cache->setTrimOnMemoryPressure(true);
+        QVERIFY(m_cache->trimOnMemoryPressure());
+        m_cache->setTrimOnMemoryPressure(false);
+        QVERIFY(!m_cache->trimOnMemoryPressure());
+    }
+
+    void testPixmapCacheMemoryUsage()
+    {
+        QCOMPARE(m_cache->pixmapCacheMemoryUsage(), 0LL);
+
+        // Lines of pixels with an odd width are padded to 32 bits
+        const QPixmap pixmap = QPixmap::fromImage(testImage(QImage::Format_RGB888));
+        QVERIFY(m_cache->insertPixmap(u"a"_s, pixmap));
+        const qint64 bytes = m_cache->pixmapCacheMemoryUsage();
+        QCOMPARE_GE(bytes, qint64(pixmap.height()) * ((pixmap.width() * pixmap.depth() / 8 + 3) & ~3));
+
+        // Copies of a pixmap share their pixels
+        QVERIFY(m_cache->insertPixmap(u"b"_s, pixmap));
+        QVERIFY(m_cache->insertPixmap(u"a"_s, pixmap));
+        QCOMPARE(m_cache->pixmapCacheMemoryUsage(), bytes);
+
+        QVERIFY(m_cache->insertPixmap(u"c"_s, QPixmap::fromImage(testImage(QImage::Format_RGB888))));
+        QCOMPARE(m_cache->pixmapCacheMemoryUsage(), 2 * bytes);
+
+        m_cache->trimLocalCache(0);
+        QCOMPARE(m_cache->pixmapCacheMemoryUsage(), 0LL);
+    }
+
+    void testPixmapCacheEvictsCopies()
+    {
+        const QPixmap pixmap = QPixmap::fromImage(testImage(QImage::Format_ARGB32_Premultiplied, QSize(64, 64)));
+        QVERIFY(m_cache->insertPixmap(u"a"_s, pixmap));
+        const qint64 bytes = m_cache->pixmapCacheMemoryUsage();
+        m_cache->setPixmapCacheLimit(int(2.5 * bytes));
+
+        QVERIFY(m_cache->insertPixmap(u"b"_s, pixmap));
+        QVERIFY(m_cache->insertPixmap(u"c"_s, pixmap));
+        QVERIFY(m_cache->findPixmap(u"b"_s, nullptr));
+        QVERIFY(m_cache->findPixmap(u"c"_s, nullptr));
+
+        // Evicting the copy that was charged for the pixels keeps them in
+        // memory, so the remaining copies have to be charged for them instead
+        for (int i = 0; i < 4; ++i) {
+            QVERIFY(m_cache->insertPixmap(u"filler"_s + QString::number(i), QPixmap::fromImage(testImage(QImage::Format_ARGB32_Premultiplied, QSize(64, 64)))));
+            QCOMPARE_LE(m_cache->pixmapCacheMemoryUsage(), m_cache->pixmapCacheLimit());
+        }
+
+        m_cache->trimLocalCache(0);
+        QCOMPARE(m_cache->pixmapCacheMemoryUsage(), 0LL);
+    }
+
+    void testStartupPrefetching()
+    {
+        QFile::remove(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + u"/kimagecachetest.kcache-startup"_s);
+
+        const QImage image = testImage(QImage::Format_ARGB32_Premultiplied);
+        QVERIFY(m_cache->insertImage(u"first"_s, image));
+        QVERIFY(m_cache->insertImage(u"second"_s, image));
+
+        // Nothing has been recorded yet
+        QVERIFY(!m_cache->startupPrefetching());
+        m_cache->setStartupPrefetching(true);
+        QVERIFY(m_cache->startupPrefetching());
+        QCOMPARE(m_cache->pixmapCacheMemoryUsage(), 0LL);
+
+        QVERIFY(m_cache->findPixmap(u"second"_s, nullptr));
+        QVERIFY(m_cache->findImage(u"first"_s, nullptr));
+        QVERIFY(!m_cache->findPixmap(u"missing"_s, nullptr));
+        m_cache->setStartupPrefetching(false);
+
+        // The next run decodes the images it is going to look up right away
+        m_cache = std::make_unique<KImageCache>(u"kimagecachetest"_s, 4 * 1024 * 1024);
+        m_cache->setStartupPrefetching(true);
+        QTRY_COMPARE(m_cache->pixmapCacheMemoryUsage(), 2 * 21 * 37 * 4LL);
+
+        QPixmap pixmap;
+        QVERIFY(m_cache->findPixmap(u"second"_s, &pixmap));
+        QCOMPARE(pixmap.size(), image.size());
+        QVERIFY(m_cache->findPixmap(u"first"_s, nullptr));
+        QCOMPARE(m_cache->statistics().localHits, 2LL);
+        QCOMPARE(m_cache->statistics().sharedHits, 0LL);
+    }
+
+    void testUpgradeLegacyEntries()
+    {
+        const QImage image = testImage(QImage::Format_ARGB32_Premultiplied);
+        const QStringList keys = {u"first"_s, u"second"_s, u"third"_s};
+        for (const QString &key : keys) {
+            QVERIFY(m_cache->insertImage(key, image));
+        }
+
+        // Only found entries are upgraded, and only once
+        m_cache->setStorageFormat(KImageCache::StorageFormat::Qoi);
+        m_cache->resetStatistics();
+        QImage found;
+        QVERIFY(m_cache->findImage(u"first"_s, &found));
+        QCOMPARE(found.convertToFormat(QImage::Format_ARGB32), image.convertToFormat(QImage::Format_ARGB32));
+        QVERIFY(m_cache->findImage(u"first"_s, &found));
+        QCOMPARE(found.convertToFormat(QImage::Format_ARGB32), image.convertToFormat(QImage::Format_ARGB32));
+        QCOMPARE(m_cache->statistics().upgradedEntries, 1LL);
+
+        m_cache->upgradeEntries(QStringList(keys) << u"missing"_s);
+        QTRY_COMPARE(m_cache->statistics().upgradedEntries, 3LL);
+
+        for (const QString &key : keys) {
+            QPixmap pixmap;
+            QVERIFY(m_cache->findPixmap(key, &pixmap));
+        }
+        QCOMPARE(m_cache->statistics().upgradedEntries, 3LL);
+    }
+
+    void testUpgradeKeepsStamp()
+    {
+        const QImage image = testImage(QImage::Format_ARGB32_Premultiplied);
+        m_cache->setGeneration(u"breeze-6.0"_s);
+        QVERIFY(m_cache->insertImage(u"breeze"_s, image));
+        m_cache->setTimeToLive(std::chrono::seconds(1));
+        QVERIFY(m_cache->insertImage(u"expiring"_s, image));
+
+        // Upgraded entries don't become part of the current generation, nor
+        // live any longer
+        m_cache->setGeneration(u"oxygen-6.0"_s);
+        m_cache->setTimeToLive(std::chrono::seconds(0));
+        m_cache->setStorageFormat(KImageCache::StorageFormat::Qoi);
+        m_cache->resetStatistics();
+        QVERIFY(m_cache->findImage(u"breeze"_s, nullptr));
+        QVERIFY(m_cache->findImage(u"expiring"_s, nullptr));
+        QCOMPARE(m_cache->statistics().upgradedEntries, 2LL);
+
+        QTest::qWait(2);
+        m_cache->invalidateGeneration(u"breeze-6.0"_s);
+        QVERIFY(!m_cache->findImage(u"breeze"_s, nullptr));
+        QTRY_VERIFY(!m_cache->findImage(u"expiring"_s, nullptr));
+    }
+
+    void testGenerations_data()
+    {
+        testFindImageAsync_data();
+    }
+
+    void testGenerations()
+    {
+        QFETCH(KImageCache::StorageFormat, storageFormat);
+        m_cache->setStorageFormat(storageFormat);
+
+        const QImage image = testImage(QImage::Format_ARGB32_Premultiplied);
+        QVERIFY(m_cache->insertImage(u"untagged"_s, image));
+        m_cache->setGeneration(u"breeze-6.0"_s);
+        QCOMPARE(m_cache->generation(), u"breeze-6.0"_s);
+        QVERIFY(m_cache->insertImage(u"breeze"_s, image));
+        QVERIFY(m_cache->insertPixmap(u"breeze-pixmap"_s, QPixmap::fromImage(image)));
+        m_cache->setGeneration(u"oxygen-6.0"_s);
+        QVERIFY(m_cache->insertImage(u"oxygen"_s, image));
+
+        QImage found;
+        QVERIFY(m_cache->findImage(u"breeze"_s, &found));
+        QCOMPARE(found.convertToFormat(QImage::Format_ARGB32), image.convertToFormat(QImage::Format_ARGB32));
+
+        // Only the entries of the invalidated generation are gone
+        QTest::qWait(2);
+        m_cache->invalidateGeneration(u"breeze-6.0"_s);
+        QVERIFY(!m_cache->findImage(u"breeze"_s, nullptr));
+        QVERIFY(!m_cache->findPixmap(u"breeze-pixmap"_s, nullptr));
+        QVERIFY(m_cache->findImage(u"oxygen"_s, nullptr));
+        QVERIFY(m_cache->findImage(u"untagged"_s, nullptr));
+
+        // Also for other cache objects
+        KImageCache other(u"kimagecachetest"_s, 4 * 1024 * 1024);
+        QVERIFY(!other.findImage(u"breeze"_s, nullptr));
+        QVERIFY(other.findImage(u"oxygen"_s, nullptr));
+
+        // Entries inserted after the invalidation are valid again
+        QTest::qWait(2);
+        m_cache->setGeneration(u"breeze-6.0"_s);
+        QVERIFY(m_cache->insertImage(u"breeze"_s, image));
+        QVERIFY(m_cache->findImage(u"breeze"_s, nullptr));
+    }
+
+    void testInvalidationsAreKept()
+    {
+        const QImage image = testImage(QImage::Format_ARGB32_Premultiplied);
+        m_cache->setGeneration(u"breeze-6.0"_s);
+        QVERIFY(m_cache->insertImage(u"breeze"_s, image));
+        QByteArray breeze;
+        QVERIFY(m_cache->find(u"breeze"_s, &breeze));
+
+        KImageCache other(u"kimagecachetest"_s, 4 * 1024 * 1024);
+        other.setGeneration(u"oxygen-6.0"_s);
+        QVERIFY(other.insertImage(u"oxygen"_s, image));
+        QByteArray oxygen;
+        QVERIFY(other.find(u"oxygen"_s, &oxygen));
+
+        // Invalidations of several cache objects don't overwrite each other
+        QTest::qWait(2);
+        QVERIFY(m_cache->invalidateGeneration(u"breeze-6.0"_s));
+        QVERIFY(other.invalidateGeneration(u"oxygen-6.0"_s));
+
+        // Nor do they get lost when the shared cache evicts entries, which
+        // clearing it is the extreme case of
+        m_cache->clear();
+        QVERIFY(m_cache->insert(u"breeze"_s, breeze));
+        QVERIFY(m_cache->insert(u"oxygen"_s, oxygen));
+
+        KImageCache third(u"kimagecachetest"_s, 4 * 1024 * 1024);
+        QVERIFY(!third.findImage(u"breeze"_s, nullptr));
+        QVERIFY(!third.findImage(u"oxygen"_s, nullptr));
+
+        // Other cache objects notice within about a second
+        QVERIFY(!m_cache->findImage(u"breeze"_s, nullptr));
+        QTRY_VERIFY(!m_cache->findImage(u"oxygen"_s, nullptr));
+        QVERIFY(!other.findImage(u"oxygen"_s, nullptr));
+        QTRY_VERIFY(!other.findImage(u"breeze"_s, nullptr));
+    }
+
+    void testGenerationsOfDecodedPixmaps()
+    {
+        const QImage image = testImage(QImage::Format_ARGB32_Premultiplied);
+        m_cache->setGeneration(u"breeze-6.0"_s);
+        QVERIFY(m_cache->insertImage(u"image"_s, image));
+        QVERIFY(m_cache->insertImage(u"other"_s, image));
+        m_cache->setGeneration(u"oxygen-6.0"_s);
+        m_cache->setTimeToLive(std::chrono::seconds(1));
+        QVERIFY(m_cache->insertImage(u"expiring"_s, image));
+
+        // Pixmaps decoded from the shared cache, in the local pixmap cache now,
+        // belong to the generation of their entry and expire along with it
+        m_cache->setTimeToLive(std::chrono::seconds(0));
+        QVERIFY(m_cache->findPixmap(u"image"_s, nullptr));
+        QCOMPARE(m_cache->findPixmaps({u"other"_s, u"expiring"_s}).size(), 2);
+        QVERIFY(m_cache->findPixmap(u"image"_s, nullptr));
+
+        QTest::qWait(2);
+        m_cache->invalidateGeneration(u"breeze-6.0"_s);
+        QVERIFY(!m_cache->findPixmap(u"image"_s, nullptr));
+        QVERIFY(!m_cache->findPixmap(u"other"_s, nullptr));
+        QTRY_VERIFY(!m_cache->findPixmap(u"expiring"_s, nullptr));
+    }
+
+    void testTimeToLive()
+    {
+        QCOMPARE(m_cache->timeToLive(), std::chrono::seconds(0));
+        m_cache->setTimeToLive(std::chrono::seconds(1));
+        QCOMPARE(m_cache->timeToLive(), std::chrono::seconds(1));
+
+        QVERIFY(m_cache->insertPixmap(u"pixmap"_s, QPixmap::fromImage(testImage(QImage::Format_ARGB32_Premultiplied))));
+        QVERIFY(m_cache->findPixmap(u"pixmap"_s, nullptr));
+        QVERIFY(m_cache->findImage(u"pixmap"_s, nullptr));
+
+        QTRY_VERIFY(!m_cache->findPixmap(u"pixmap"_s, nullptr));
+        QVERIFY(!m_cache->findImage(u"pixmap"_s, nullptr));
+    }
+
+    void testMixedFormats()
+    {
+        const QImage image = testImage(QImage::Format_ARGB32_Premultiplied);
+
+        m_cache->setStorageFormat(KImageCache::StorageFormat::Png);
+        QVERIFY(m_cache->insertImage(u"png"_s, image));
+        m_cache->setStorageFormat(KImageCache::StorageFormat::Raw);
+        QVERIFY(m_cache->insertImage(u"raw"_s, image));
+        m_cache->setStorageFormat(KImageCache::StorageFormat::Qoi);
+        QVERIFY(m_cache->insertImage(u"qoi"_s, image));
+
+        // Entries are readable no matter which format is currently selected
+        for (auto format : {KImageCache::StorageFormat::Png, KImageCache::StorageFormat::Raw, KImageCache::StorageFormat::Qoi}) {
+            m_cache->setStorageFormat(format);
+
+            for (const QString &key : {u"png"_s, u"raw"_s, u"qoi"_s}) {
+                QImage found;
+                QVERIFY(m_cache->findImage(key, &found));
+                QCOMPARE(found.convertToFormat(QImage::Format_ARGB32), image.convertToFormat(QImage::Format_ARGB32));
+            }
+        }
+    }
+};
+
+QTEST_MAIN(KImageCacheTest)
+
+#include "kimagecachetest.moc"
@@ -0,0 +1,389 @@
+/*
+    SPDX-FileCopyrightText: 2007 Matthew Woehlke <mw_triad@users.sourceforge.net>
+    SPDX-FileCopyrightText: 2007 Olaf Schmidt <ojschmidt@kde.org>
+    SPDX-FileCopyrightText: 2026 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef KCOLORMATH_H
+#define KCOLORMATH_H
+
+#include <QColor>
+
+#include <climits>
+
+// Not API: only the helpers the functions in KColorMath need
+namespace KColorMathPrivate
+{
+// normalize: like qBound(a, 0.0, 1.0) but without needing the args and with
+// "safer" behavior on NaN (isnan(a) -> return 0.0)
+template<typename T>
+constexpr T normalize(T a)
+{
+    return (a < T(1.0) ? (a > T(0.0) ? a : T(0.0)) : T(1.0));
+}
+
+// channelF: the component of a QColor created from an 8-bit value, exactly like
+// QColor::redF() etc. return it
+constexpr float channelF(int value)
+{
+    return (value * 257) / float(USHRT_MAX);
+}
+
+// channel8: the 8-bit component of a QColor created with QColor::fromRgbF(),
+// exactly like QColor::red() etc. return it, but without creating a QColor:
+// rounded to 16 bits, then to 8 bits like QRgba64::red8(). kcolormathtest
+// compares it with QColor for every 16-bit value.
+constexpr int channel8(qreal value)
+{
+    const int value16 = qRound(float(normalize(value)) * USHRT_MAX);
+    return (value16 + 128 - ((value16 + 128) >> 8)) >> 8;
+}
+
+// a modulo 1, in [0, 1), like fmod(a, 1.0) followed by adding 1 to negative
+// results, and 0 for NaN and infinity
+template<typename T>
+constexpr T wrap(T a)
+{
+    // Larger values have no fractional part
+    if (!(a > T(-4503599627370496.0) && a < T(4503599627370496.0))) {
+        return T(0.0);
+    }
+    const T r = a - T(qint64(a));
+    return (r < T(0.0) ? T(1.0) + r : (r > T(0.0) ? r : T(0.0)));
+}
+
+// The n-th root of x in [0, 1], by Newton's method from above. x is scaled
+// into [2^-n, 1) first, where the root is at least 0.5 and few steps do.
+constexpr qreal root(qreal x, int n)
+{
+    if (!(x > 0.0)) {
+        return 0.0;
+    }
+    if (x >= 1.0) {
+        return 1.0;
+    }
+
+    qreal powerOfTwo = 1.0;
+    for (int i = 0; i < n; ++i) {
+        powerOfTwo *= 2.0;
+    }
+    qreal scale = 1.0;
+    while (x < 1.0 / powerOfTwo) {
+        x *= powerOfTwo;
+        scale *= 0.5;
+    }
+
+    qreal y = 1.0;
+    for (;;) {
+        qreal power = 1.0;
+        for (int i = 1; i < n; ++i) {
+            power *= y;
+        }
+        const qreal next = ((n - 1) * y + x / power) / n;
+        if (!(next < y)) {
+            return y * scale;
+        }
+        y = next;
+    }
+}
+
+// Rec. 709 luma coefficients
+inline constexpr qreal yc[3] = {0.2126, 0.7152, 0.0722};
+}
+
+/*!
+ * \namespace KColorMath
+ * \inmodule KGuiAddons
+ *
+ * \brief Color math of KColorUtils that can be evaluated at compile time.
+ *
+ * These functions work on QRgb values that are not premultiplied, and are
+ * constexpr, so that colors derived from constants can be computed by the
+ * compiler, and checked with static_assert:
+ * \code
+ *   constexpr QRgb accent = qRgb(0x3d, 0xae, 0xe9);
+ *   constexpr QRgb hover = KColorMath::lighten(accent, 0.2);
+ *   static_assert(KColorMath::contrastRatio(hover, qRgb(0x23, 0x26, 0x29)) >= 4.5);
+ * \endcode
+ *
+ * The gamma curve is computed with Newton's method rather than pow(), so
+ * results may differ in the last bits from those of KColorUtils, and a
+ * channel may rarely differ by one.
+ *
+ * \since 6.30
+ */
+namespace KColorMath
+{
+/*!
+ * \struct KColorMath::Hcy
+ * \inmodule KGuiAddons
+ *
+ * \brief A color in the HCY color space that KColorUtils uses.
+ *
+ * \sa KColorUtils::getHcy()
+ */
+struct Hcy {
+    /*!
+     * \variable KColorMath::Hcy::h
+     * The hue, which is cyclical. toHcy() gives it from 0.0 to 1.0.
+     */
+    qreal h = 0.0;
+    /*!
+     * \variable KColorMath::Hcy::c
+     * The chroma, from 0.0 (none) to 1.0 (full).
+     */
+    qreal c = 0.0;
+    /*!
+     * \variable KColorMath::Hcy::y
+     * The luma, from 0.0 (black) to 1.0 (white).
+     */
+    qreal y = 0.0;
+    /*!
+     * \variable KColorMath::Hcy::a
+     * The alpha, from 0.0 to 1.0.
+     */
+    qreal a = 1.0;
+};
+
+/*!
+ * Returns \a n, which is clamped to the range from 0.0 to 1.0, raised to the
+ * power of 2.2, which is the gamma that KColorUtils assumes.
+ */
+constexpr qreal gamma(qreal n)
+{
+    n = KColorMathPrivate::normalize(n);
+    return n * n * KColorMathPrivate::root(n, 5);
+}
+
+/*!
+ * Returns \a n, which is clamped to the range from 0.0 to 1.0, raised to the
+ * power of 1 / 2.2, which undoes gamma().
+ */
+constexpr qreal inverseGamma(qreal n)
+{
+    const qreal r = KColorMathPrivate::root(KColorMathPrivate::normalize(n), 11);
+    return r * r * r * r * r;
+}
+
+/*!
+ * Returns \a color in the HCY color space.
+ *
+ * \sa KColorUtils::getHcy()
+ */
+constexpr Hcy toHcy(QRgb color)
+{
+    using KColorMathPrivate::channelF;
+    using KColorMathPrivate::yc;
+    const qreal r = gamma(channelF(qRed(color)));
+    const qreal g = gamma(channelF(qGreen(color)));
+    const qreal b = gamma(channelF(qBlue(color)));
+
+    Hcy hcy;
+    hcy.a = channelF(qAlpha(color));
+
+    // luma component
+    hcy.y = r * yc[0] + g * yc[1] + b * yc[2];
+
+    // hue component
+    const qreal p = qMax(qMax(r, g), b);
+    const qreal n = qMin(qMin(r, g), b);
+    const qreal d = 6.0 * (p - n);
+    if (n == p) {
+        hcy.h = 0.0;
+    } else if (r == p) {
+        hcy.h = ((g - b) / d);
+    } else if (g == p) {
+        hcy.h = ((b - r) / d) + (1.0 / 3.0);
+    } else {
+        hcy.h = ((r - g) / d) + (2.0 / 3.0);
+    }
+    hcy.h += hcy.h < 0.0 ? 1.0 : 0.0;
+
+    // chroma component
+    if (r == g && g == b) {
+        hcy.c = 0.0;
+    } else {
+        hcy.c = qMax((hcy.y - n) / hcy.y, (p - hcy.y) / (1.0 - hcy.y));
+    }
+    return hcy;
+}
+
+/*!
+ * Returns \a hcy as an 8-bit color. Out of range chroma and luma are clamped.
+ *
+ * \sa KColorUtils::hcyColor()
+ */
+constexpr QRgb fromHcy(const Hcy &hcy)
+{
+    using KColorMathPrivate::channel8;
+    using KColorMathPrivate::normalize;
+    using KColorMathPrivate::yc;
+
+    // start with sane component values
+    const qreal _h = KColorMathPrivate::wrap(hcy.h);
+    const qreal _c = normalize(hcy.c);
+    const qreal _y = normalize(hcy.y);
+
+    // calculate some needed variables
+    const qreal _hs = _h * 6.0;
+    qreal th = 0.0;
+    qreal tm = 0.0;
+    if (_hs < 1.0) {
+        th = _hs;
+        tm = yc[0] + yc[1] * th;
+    } else if (_hs < 2.0) {
+        th = 2.0 - _hs;
+        tm = yc[1] + yc[0] * th;
+    } else if (_hs < 3.0) {
+        th = _hs - 2.0;
+        tm = yc[1] + yc[2] * th;
+    } else if (_hs < 4.0) {
+        th = 4.0 - _hs;
+        tm = yc[2] + yc[1] * th;
+    } else if (_hs < 5.0) {
+        th = _hs - 4.0;
+        tm = yc[2] + yc[0] * th;
+    } else {
+        th = 6.0 - _hs;
+        tm = yc[0] + yc[2] * th;
+    }
+
+    // calculate RGB channels in sorted order
+    qreal tn = 0.0;
+    qreal to = 0.0;
+    qreal tp = 0.0;
+    if (tm >= _y) {
+        tp = _y + _y * _c * (1.0 - tm) / tm;
+        to = _y + _y * _c * (th - tm) / tm;
+        tn = _y - (_y * _c);
+    } else {
+        tp = _y + (1.0 - _y) * _c;
+        to = _y + (1.0 - _y) * _c * (th - tm) / (1.0 - tm);
+        tn = _y - (1.0 - _y) * _c * tm / (1.0 - tm);
+    }
+
+    // return RGB channels in appropriate order
+    const int p = channel8(inverseGamma(tp));
+    const int o = channel8(inverseGamma(to));
+    const int n = channel8(inverseGamma(tn));
+    const int a = channel8(hcy.a);
+    if (_hs < 1.0) {
+        return qRgba(p, o, n, a);
+    } else if (_hs < 2.0) {
+        return qRgba(o, p, n, a);
+    } else if (_hs < 3.0) {
+        return qRgba(n, p, o, a);
+    } else if (_hs < 4.0) {
+        return qRgba(n, o, p, a);
+    } else if (_hs < 5.0) {
+        return qRgba(o, n, p, a);
+    } else {
+        return qRgba(p, n, o, a);
+    }
+}
+
+/*!
+ * Returns the luma of \a color.
+ *
+ * \sa KColorUtils::luma()
+ */
+constexpr qreal luma(QRgb color)
+{
+    return toHcy(color).y;
+}
+
+/*!
+ * Returns the contrast ratio between \a c1 and \a c2, from 1.0 to 21.0.
+ *
+ * \sa KColorUtils::contrastRatio()
+ */
+constexpr qreal contrastRatio(QRgb c1, QRgb c2)
+{
+    const qreal y1 = luma(c1);
+    const qreal y2 = luma(c2);
+    return y1 > y2 ? (y1 + 0.05) / (y2 + 0.05) : (y2 + 0.05) / (y1 + 0.05);
+}
+
+/*!
+ * Returns \a color with its luma moved towards white by \a amount, and its
+ * chroma multiplied by \a chromaInverseGain as seen from full chroma.
+ *
+ * \sa KColorUtils::lighten()
+ */
+constexpr QRgb lighten(QRgb color, qreal amount = 0.5, qreal chromaInverseGain = 1.0)
+{
+    using KColorMathPrivate::normalize;
+    Hcy hcy = toHcy(color);
+    hcy.y = 1.0 - normalize((1.0 - hcy.y) * (1.0 - amount));
+    hcy.c = 1.0 - normalize((1.0 - hcy.c) * chromaInverseGain);
+    return fromHcy(hcy);
+}
+
+/*!
+ * Returns \a color with its luma moved towards black by \a amount, and its
+ * chroma multiplied by \a chromaGain.
+ *
+ * \sa KColorUtils::darken()
+ */
+constexpr QRgb darken(QRgb color, qreal amount = 0.5, qreal chromaGain = 1.0)
+{
+    using KColorMathPrivate::normalize;
+    Hcy hcy = toHcy(color);
+    hcy.y = normalize(hcy.y * (1.0 - amount));
+    hcy.c = normalize(hcy.c * chromaGain);
+    return fromHcy(hcy);
+}
+
+/*!
+ * Returns \a color with \a lumaAmount added to its luma and \a chromaAmount
+ * added to its chroma.
+ *
+ * \sa KColorUtils::shade()
+ */
+constexpr QRgb shade(QRgb color, qreal lumaAmount, qreal chromaAmount = 0.0)
+{
+    using KColorMathPrivate::normalize;
+    Hcy hcy = toHcy(color);
+    hcy.y = normalize(hcy.y + lumaAmount);
+    hcy.c = normalize(hcy.c + chromaAmount);
+    return fromHcy(hcy);
+}
+
+/*!
+ * Returns \a c1 and \a c2 mixed with \a bias, from 0.0 for \a c1 to 1.0 for
+ * \a c2. This only involves arithmetic, and gives exactly what
+ * KColorUtils::mix() gives.
+ *
+ * \sa KColorUtils::mix()
+ */
+constexpr QRgb mix(QRgb c1, QRgb c2, qreal bias = 0.5)
+{
+    if (!(bias > 0.0)) {
+        // Also for NaN
+        return c1;
+    }
+    if (bias >= 1.0) {
+        return c2;
+    }
+
+    using KColorMathPrivate::channel8;
+    using KColorMathPrivate::channelF;
+    const auto mixQreal = [bias](qreal a, qreal b) {
+        return a + (b - a) * bias;
+    };
+    const float a1 = channelF(qAlpha(c1));
+    const float a2 = channelF(qAlpha(c2));
+    const qreal a = mixQreal(a1, a2);
+    if (a <= 0.0) {
+        return 0;
+    }
+    const qreal r = qBound(0.0, mixQreal(channelF(qRed(c1)) * a1, channelF(qRed(c2)) * a2), 1.0) / a;
+    const qreal g = qBound(0.0, mixQreal(channelF(qGreen(c1)) * a1, channelF(qGreen(c2)) * a2), 1.0) / a;
+    const qreal b = qBound(0.0, mixQreal(channelF(qBlue(c1)) * a1, channelF(qBlue(c2)) * a2), 1.0) / a;
+    return qRgba(channel8(r), channel8(g), channel8(b), channel8(a));
+}
+}
+
+#endif // KCOLORMATH_H
@@ -0,0 +1,131 @@
+/*
+    SPDX-FileCopyrightText: 2007 Matthew Woehlke <mw_triad@users.sourceforge.net>
+    SPDX-FileCopyrightText: 2007 Olaf Schmidt <ojschmidt@kde.org>
+    SPDX-FileCopyrightText: 2026 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef KCOLORMATH_P_H
+#define KCOLORMATH_P_H
+
+#include "kcolormath.h"
+
+namespace KColorMathPrivate
+{
+/*
+ * The conversion between linear RGB and HCY, shared by KHCY in double and
+ * KHCYF in single precision. All constants are converted to T, so that the
+ * float version is not promoted to double and the double version gives the
+ * same results as it always did.
+ */
+template<typename T>
+struct HCYKernel {
+    static constexpr T luma(T r, T g, T b)
+    {
+        return r * T(yc[0]) + g * T(yc[1]) + b * T(yc[2]);
+    }
+
+    static constexpr void toHcy(T r, T g, T b, T *h, T *c, T *y)
+    {
+        // luma component
+        *y = luma(r, g, b);
+
+        // hue component
+        T p = qMax(qMax(r, g), b);
+        T n = qMin(qMin(r, g), b);
+        T d = T(6.0) * (p - n);
+        if (n == p) {
+            *h = T(0.0);
+        } else if (r == p) {
+            *h = ((g - b) / d);
+        } else if (g == p) {
+            *h = ((b - r) / d) + T(1.0 / 3.0);
+        } else {
+            *h = ((r - g) / d) + T(2.0 / 3.0);
+        }
+
+        // chroma component
+        if (r == g && g == b) {
+            *c = T(0.0);
+        } else {
+            *c = qMax((*y - n) / *y, (p - *y) / (T(1.0) - *y));
+        }
+    }
+
+    static constexpr void toRgb(T h, T c, T y, T *r, T *g, T *b)
+    {
+        // start with sane component values
+        T _h = wrap(h);
+        T _c = normalize(c);
+        T _y = normalize(y);
+
+        // calculate some needed variables
+        T _hs = _h * T(6.0);
+        T th = T(0.0);
+        T tm = T(0.0);
+        if (_hs < T(1.0)) {
+            th = _hs;
+            tm = T(yc[0]) + T(yc[1]) * th;
+        } else if (_hs < T(2.0)) {
+            th = T(2.0) - _hs;
+            tm = T(yc[1]) + T(yc[0]) * th;
+        } else if (_hs < T(3.0)) {
+            th = _hs - T(2.0);
+            tm = T(yc[1]) + T(yc[2]) * th;
+        } else if (_hs < T(4.0)) {
+            th = T(4.0) - _hs;
+            tm = T(yc[2]) + T(yc[1]) * th;
+        } else if (_hs < T(5.0)) {
+            th = _hs - T(4.0);
+            tm = T(yc[2]) + T(yc[0]) * th;
+        } else {
+            th = T(6.0) - _hs;
+            tm = T(yc[0]) + T(yc[2]) * th;
+        }
+
+        // calculate RGB channels in sorted order
+        T tn = T(0.0);
+        T to = T(0.0);
+        T tp = T(0.0);
+        if (tm >= _y) {
+            tp = _y + _y * _c * (T(1.0) - tm) / tm;
+            to = _y + _y * _c * (th - tm) / tm;
+            tn = _y - (_y * _c);
+        } else {
+            tp = _y + (T(1.0) - _y) * _c;
+            to = _y + (T(1.0) - _y) * _c * (th - tm) / (T(1.0) - tm);
+            tn = _y - (T(1.0) - _y) * _c * tm / (T(1.0) - tm);
+        }
+
+        // return RGB channels in appropriate order
+        if (_hs < T(1.0)) {
+            *r = tp;
+            *g = to;
+            *b = tn;
+        } else if (_hs < T(2.0)) {
+            *r = to;
+            *g = tp;
+            *b = tn;
+        } else if (_hs < T(3.0)) {
+            *r = tn;
+            *g = tp;
+            *b = to;
+        } else if (_hs < T(4.0)) {
+            *r = tn;
+            *g = to;
+            *b = tp;
+        } else if (_hs < T(5.0)) {
+            *r = to;
+            *g = tn;
+            *b = tp;
+        } else {
+            *r = tp;
+            *g = tn;
+            *b = to;
+        }
+    }
+};
+}
+
+#endif // KCOLORMATH_P_H
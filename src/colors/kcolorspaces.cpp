@@ -5,45 +5,115 @@
     SPDX-License-Identifier: LGPL-2.0-or-later
 */
 #include "kcolorspaces_p.h"
+#include "kcolormath_p.h"
 #include "kguiaddons_colorhelpers_p.h"
 
 #include <QColor>
 
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <math.h>
 
 using namespace KColorSpaces;
 
-static inline qreal wrap(qreal a, qreal d = 1.0)
-{
-    qreal r = fmod(a, d);
-    return (r < 0.0 ? d + r : (r > 0.0 ? r : 0.0));
-}
+using KColorMathPrivate::HCYKernel;
+using KColorMathPrivate::wrap;
 
 ///////////////////////////////////////////////////////////////////////////////
 // HCY color space
 
-#define HCY_REC 709 // use 709 for now
-#if HCY_REC == 601
-static const qreal yc[3] = {0.299, 0.587, 0.114};
-#elif HCY_REC == 709
-static const qreal yc[3] = {0.2126, 0.7152, 0.0722};
-#else // use Qt values
-static const qreal yc[3] = {0.34375, 0.5, 0.15625};
-#endif
-
 qreal KHCY::gamma(qreal n)
 {
     return pow(normalize(n), 2.2);
 }
 
-qreal KHCY::igamma(qreal n)
+// Same as gamma(QColor::fromRgb(...).redF()) etc., for 8-bit channels
+qreal KHCY::gamma8(int n)
 {
-    return pow(normalize(n), 1.0 / 2.2);
+    static const std::array<qreal, 256> table = [] {
+        std::array<qreal, 256> values;
+        for (int i = 0; i < 256; ++i) {
+            values[i] = gamma(qreal(channelF(i)));
+        }
+        return values;
+    }();
+    return table[n];
+}
+
+// Same as gamma(color.redF()) etc., but using gamma8() for channels holding an
+// 8-bit value, which most colors do
+void KHCY::gamma(const QColor &color, qreal *r, qreal *g, qreal *b)
+{
+    if (color.spec() != QColor::Rgb) {
+        *r = gamma(color.redF());
+        *g = gamma(color.greenF());
+        *b = gamma(color.blueF());
+        return;
+    }
+
+    const QRgba64 rgba = color.rgba64();
+    const auto channelGamma = [](quint16 value) {
+        return value % 257 == 0 ? gamma8(value / 257) : gamma(value / float(USHRT_MAX));
+    };
+    *r = channelGamma(rgba.red());
+    *g = channelGamma(rgba.green());
+    *b = channelGamma(rgba.blue());
+}
+
+// Define to 1 to compute igamma() with pow(), e.g. to compare results with
+// older versions
+#ifndef HCY_EXACT_GAMMA
+#define HCY_EXACT_GAMMA 0
+#endif
+
+// Largest absolute difference between fastIgamma(n) and pow(n, 1 / 2.2) for
+// doubles; floats add their own rounding error of about 6e-8
+static const qreal igammaMaxError = 3.5e-7;
+
+// n^(1/2.2) as m^(1/2.2) * 2^(e/2.2) with n = m * 2^e, interpolating linearly
+// between 256 steps of the mantissa m, which lies in [0.5, 1)
+template<typename T>
+static T fastIgamma(T n)
+{
+    static constexpr int steps = 256;
+    static constexpr int minExponent = -64;
+    static const std::array<T, steps + 1> mantissas = [] {
+        std::array<T, steps + 1> values;
+        for (int i = 0; i <= steps; ++i) {
+            values[i] = T(pow(0.5 + 0.5 * i / steps, 1.0 / 2.2));
+        }
+        return values;
+    }();
+    static const std::array<T, 2 - minExponent> exponents = [] {
+        std::array<T, 2 - minExponent> values;
+        for (int e = 1; e >= minExponent; --e) {
+            values[1 - e] = T(pow(2.0, e / 2.2));
+        }
+        return values;
+    }();
+
+    n = normalize(n);
+    int e;
+    const T m = std::frexp(n, &e);
+    if (e < minExponent) {
+        // includes 0, and is far below what a 16-bit channel can tell apart
+        return std::pow(n, T(1.0 / 2.2));
+    }
+
+    const T position = (m - T(0.5)) * (2 * steps);
+    const int i = qMin(int(position), steps - 1);
+    const T fraction = position - i;
+    return (mantissas[i] + (mantissas[i + 1] - mantissas[i]) * fraction) * exponents[1 - e];
 }
 
-qreal KHCY::lumag(qreal r, qreal g, qreal b)
+qreal KHCY::igamma(qreal n)
 {
-    return r * yc[0] + g * yc[1] + b * yc[2];
+#if HCY_EXACT_GAMMA
+    return pow(normalize(n), 1.0 / 2.2);
+#else
+    return fastIgamma(n);
+#endif
 }
 
 KHCY::KHCY(qreal h_, qreal c_, qreal y_, qreal a_)
@@ -56,95 +126,21 @@ KHCY::KHCY(qreal h_, qreal c_, qreal y_, qreal a_)
 
 KHCY::KHCY(const QColor &color)
 {
-    qreal r = gamma(color.redF());
-    qreal g = gamma(color.greenF());
-    qreal b = gamma(color.blueF());
     a = color.alphaF();
-
-    // luma component
-    y = lumag(r, g, b);
-
-    // hue component
-    qreal p = qMax(qMax(r, g), b);
-    qreal n = qMin(qMin(r, g), b);
-    qreal d = 6.0 * (p - n);
-    if (n == p) {
-        h = 0.0;
-    } else if (r == p) {
-        h = ((g - b) / d);
-    } else if (g == p) {
-        h = ((b - r) / d) + (1.0 / 3.0);
-    } else {
-        h = ((r - g) / d) + (2.0 / 3.0);
-    }
-
-    // chroma component
-    if (r == g && g == b) {
-        c = 0.0;
-    } else {
-        c = qMax((y - n) / y, (p - y) / (1 - y));
-    }
+    qreal r;
+    qreal g;
+    qreal b;
+    gamma(color, &r, &g, &b);
+    HCYKernel<qreal>::toHcy(r, g, b, &h, &c, &y);
 }
 
 QColor KHCY::qColor() const
 {
-    // start with sane component values
-    qreal _h = wrap(h);
-    qreal _c = normalize(c);
-    qreal _y = normalize(y);
-
-    // calculate some needed variables
-    qreal _hs = _h * 6.0;
-    qreal th;
-    qreal tm;
-    if (_hs < 1.0) {
-        th = _hs;
-        tm = yc[0] + yc[1] * th;
-    } else if (_hs < 2.0) {
-        th = 2.0 - _hs;
-        tm = yc[1] + yc[0] * th;
-    } else if (_hs < 3.0) {
-        th = _hs - 2.0;
-        tm = yc[1] + yc[2] * th;
-    } else if (_hs < 4.0) {
-        th = 4.0 - _hs;
-        tm = yc[2] + yc[1] * th;
-    } else if (_hs < 5.0) {
-        th = _hs - 4.0;
-        tm = yc[2] + yc[0] * th;
-    } else {
-        th = 6.0 - _hs;
-        tm = yc[0] + yc[2] * th;
-    }
-
-    // calculate RGB channels in sorted order
-    qreal tn;
-    qreal to;
-    qreal tp;
-    if (tm >= _y) {
-        tp = _y + _y * _c * (1.0 - tm) / tm;
-        to = _y + _y * _c * (th - tm) / tm;
-        tn = _y - (_y * _c);
-    } else {
-        tp = _y + (1.0 - _y) * _c;
-        to = _y + (1.0 - _y) * _c * (th - tm) / (1.0 - tm);
-        tn = _y - (1.0 - _y) * _c * tm / (1.0 - tm);
-    }
-
-    // return RGB channels in appropriate order
-    if (_hs < 1.0) {
-        return QColor::fromRgbF(igamma(tp), igamma(to), igamma(tn), a);
-    } else if (_hs < 2.0) {
-        return QColor::fromRgbF(igamma(to), igamma(tp), igamma(tn), a);
-    } else if (_hs < 3.0) {
-        return QColor::fromRgbF(igamma(tn), igamma(tp), igamma(to), a);
-    } else if (_hs < 4.0) {
-        return QColor::fromRgbF(igamma(tn), igamma(to), igamma(tp), a);
-    } else if (_hs < 5.0) {
-        return QColor::fromRgbF(igamma(to), igamma(tn), igamma(tp), a);
-    } else {
-        return QColor::fromRgbF(igamma(tp), igamma(tn), igamma(to), a);
-    }
+    qreal r;
+    qreal g;
+    qreal b;
+    HCYKernel<qreal>::toRgb(h, c, y, &r, &g, &b);
+    return QColor::fromRgbF(igamma(r), igamma(g), igamma(b), a);
 }
 
 qreal KHCY::hue(const QColor &color)
@@ -159,5 +155,86 @@ qreal KHCY::chroma(const QColor &color)
 
 qreal KHCY::luma(const QColor &color)
 {
-    return lumag(gamma(color.redF()), gamma(color.greenF()), gamma(color.blueF()));
+    qreal r;
+    qreal g;
+    qreal b;
+    gamma(color, &r, &g, &b);
+    return HCYKernel<qreal>::luma(r, g, b);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// HCY color space in single precision
+
+float KHCYF::gamma(float n)
+{
+    return std::pow(normalize(n), 2.2f);
+}
+
+// Rounded from the values of KHCY::gamma8(), so that 8-bit channels start out
+// as close as possible to the double precision path
+float KHCYF::gamma8(int n)
+{
+    static const std::array<float, 256> table = [] {
+        std::array<float, 256> values;
+        for (int i = 0; i < 256; ++i) {
+            values[i] = float(pow(qreal(channelF(i)), 2.2));
+        }
+        return values;
+    }();
+    return table[n];
+}
+
+float KHCYF::igamma(float n)
+{
+#if HCY_EXACT_GAMMA
+    return std::pow(normalize(n), 1.0f / 2.2f);
+#else
+    return fastIgamma(n);
+#endif
+}
+
+KHCYF::KHCYF(QRgb color)
+{
+    a = channelF(qAlpha(color));
+    HCYKernel<float>::toHcy(gamma8(qRed(color)), gamma8(qGreen(color)), gamma8(qBlue(color)), &h, &c, &y);
+}
+
+KHCYF::KHCYF(QRgba64 color)
+{
+    a = color.alpha() / float(USHRT_MAX);
+    const float r = gamma(color.red() / float(USHRT_MAX));
+    const float g = gamma(color.green() / float(USHRT_MAX));
+    const float b = gamma(color.blue() / float(USHRT_MAX));
+    HCYKernel<float>::toHcy(r, g, b, &h, &c, &y);
+}
+
+QRgb KHCYF::rgba() const
+{
+    float r;
+    float g;
+    float b;
+    HCYKernel<float>::toRgb(h, c, y, &r, &g, &b);
+    return qRgba(channel8(igamma(r)), channel8(igamma(g)), channel8(igamma(b)), channel8(a));
+}
+
+QRgba64 KHCYF::rgba64() const
+{
+    float r;
+    float g;
+    float b;
+    HCYKernel<float>::toRgb(h, c, y, &r, &g, &b);
+    const auto channel16 = [](float value) {
+        return quint16(qRound(normalize(value) * USHRT_MAX));
+    };
+    return qRgba64(channel16(igamma(r)), channel16(igamma(g)), channel16(igamma(b)), channel16(a));
+}
+
+void KHCYF::luma(std::span<const QRgb> colors, std::span<float> lumas)
+{
+    Q_ASSERT(lumas.size() >= colors.size());
+    const size_t count = std::min(colors.size(), lumas.size());
+    for (size_t i = 0; i < count; ++i) {
+        const QRgb color = colors[i];
+        lumas[i] = HCYKernel<float>::luma(gamma8(qRed(color)), gamma8(qGreen(color)), gamma8(qBlue(color)));
+    }
 }
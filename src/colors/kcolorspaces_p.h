@@ -15,6 +15,8 @@
 
 #include <QColor>
 
+#include <span>
+
 namespace KColorSpaces
 {
 class KHCY
@@ -30,8 +32,31 @@ public:
 
 private:
     static qreal gamma(qreal);
+    static qreal gamma8(int);
+    static void gamma(const QColor &, qreal *r, qreal *g, qreal *b);
     static qreal igamma(qreal);
-    static qreal lumag(qreal, qreal, qreal);
+};
+
+/*
+ * KHCY in single precision, converting from and to plain QRgb or QRgba64
+ * rather than QColor. Meant for batch operations on many colors, such as the
+ * pixels of an image, where a channel being off by one now and then doesn't
+ * matter but the cost of the conversion does.
+ */
+class KHCYF
+{
+public:
+    explicit KHCYF(QRgb);
+    explicit KHCYF(QRgba64);
+    QRgb rgba() const;
+    QRgba64 rgba64() const;
+    float h, c, y, a;
+    static void luma(std::span<const QRgb>, std::span<float>);
+
+private:
+    static float gamma(float);
+    static float gamma8(int);
+    static float igamma(float);
 };
 
 }
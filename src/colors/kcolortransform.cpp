@@ -0,0 +1,325 @@
+/*
+    SPDX-FileCopyrightText: 2026 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "kcolortransform.h"
+#include "kcolorutils_p.h"
+
+#include <QByteArray>
+#include <QCache>
+#include <QDataStream>
+#include <QImage>
+#include <QMutex>
+
+#include <array>
+#include <climits>
+#include <vector>
+
+// Identifies the data of toByteArray(), "KCTF"
+static const quint32 serializationMagic = 0x4b435446;
+static const quint8 serializationVersion = 1;
+
+// Upper limit of the tables kept by KColorTransform::cached(), in bytes
+static const qsizetype cacheLimit = 8 * 1024 * 1024;
+
+// BEGIN KColorTransformPrivate
+class KColorTransformPrivate : public QSharedData
+{
+public:
+    void computeTable();
+    void initInterpolation();
+    QRgb map(QRgb color) const;
+
+    QList<KColorTransform::Step> steps;
+    int gridSize = 0;
+    // The red, green and blue of each grid point, in 16 bits, with blue
+    // changing fastest
+    std::vector<quint16> table;
+    // The grid point below each 8-bit channel value, and the position of the
+    // value between it and the next grid point
+    std::array<int, 256> indexes;
+    std::array<float, 256> fractions;
+};
+
+void KColorTransformPrivate::computeTable()
+{
+    table.resize(size_t(gridSize) * gridSize * gridSize * 3);
+    const auto channel = [this](int index) {
+        return quint16(qRound(index * qreal(USHRT_MAX) / (gridSize - 1)));
+    };
+
+    size_t i = 0;
+    for (int r = 0; r < gridSize; ++r) {
+        for (int g = 0; g < gridSize; ++g) {
+            for (int b = 0; b < gridSize; ++b) {
+                QColor color = QColor::fromRgba64(channel(r), channel(g), channel(b));
+                for (const KColorTransform::Step &step : std::as_const(steps)) {
+                    color = KColorUtils::recolor(color, step.operation, step.parameters);
+                }
+                const QRgba64 result = color.rgba64();
+                table[i++] = result.red();
+                table[i++] = result.green();
+                table[i++] = result.blue();
+            }
+        }
+    }
+}
+
+void KColorTransformPrivate::initInterpolation()
+{
+    for (int value = 0; value < 256; ++value) {
+        const float position = value * float(gridSize - 1) / 255;
+        indexes[value] = qMin(int(position), gridSize - 2);
+        fractions[value] = position - indexes[value];
+    }
+}
+
+QRgb KColorTransformPrivate::map(QRgb color) const
+{
+    const size_t blueStride = 3;
+    const size_t greenStride = blueStride * gridSize;
+    const size_t redStride = greenStride * gridSize;
+    const float fr = fractions[qRed(color)];
+    const float fg = fractions[qGreen(color)];
+    const float fb = fractions[qBlue(color)];
+    const quint16 *corner = table.data() + indexes[qRed(color)] * redStride + indexes[qGreen(color)] * greenStride + indexes[qBlue(color)] * blueStride;
+
+    int channels[3];
+    for (int i = 0; i < 3; ++i) {
+        const quint16 *c = corner + i;
+        const float c00 = c[0] + (c[blueStride] - c[0]) * fb;
+        const float c01 = c[greenStride] + (c[greenStride + blueStride] - c[greenStride]) * fb;
+        const float c10 = c[redStride] + (c[redStride + blueStride] - c[redStride]) * fb;
+        const float c11 = c[redStride + greenStride] + (c[redStride + greenStride + blueStride] - c[redStride + greenStride]) * fb;
+        const float c0 = c00 + (c01 - c00) * fg;
+        const float c1 = c10 + (c11 - c10) * fg;
+        channels[i] = qRound((c0 + (c1 - c0) * fr) / 257.0f);
+    }
+    return qRgba(channels[0], channels[1], channels[2], qAlpha(color));
+}
+// END KColorTransformPrivate
+
+static int boundedGridSize(int gridSize)
+{
+    return qBound(2, gridSize, 65);
+}
+
+// The steps and the grid size, which identify a table
+static void writeChain(QDataStream &stream, const QList<KColorTransform::Step> &steps, int gridSize)
+{
+    stream << quint8(gridSize) << quint32(steps.size());
+    for (const KColorTransform::Step &step : steps) {
+        const KColorUtils::RecolorParameters &parameters = step.parameters;
+        stream << quint8(step.operation) << quint64(parameters.color.rgba64()) << double(parameters.amount) << parameters.chroma.has_value()
+               << double(parameters.chroma.value_or(0.0));
+    }
+}
+
+static bool readChain(QDataStream &stream, QList<KColorTransform::Step> *steps, int *gridSize)
+{
+    quint8 size;
+    quint32 count;
+    stream >> size >> count;
+    if (stream.status() != QDataStream::Ok || size != boundedGridSize(size) || count > 1024) {
+        return false;
+    }
+
+    steps->clear();
+    for (quint32 i = 0; i < count; ++i) {
+        quint8 operation;
+        quint64 color;
+        double amount;
+        bool hasChroma;
+        double chroma;
+        stream >> operation >> color >> amount >> hasChroma >> chroma;
+        if (stream.status() != QDataStream::Ok || operation > quint8(KColorUtils::RecolorOperation::Mix)) {
+            return false;
+        }
+
+        KColorTransform::Step step{KColorUtils::RecolorOperation(operation), {QColor::fromRgba64(QRgba64::fromRgba64(color)), amount, std::nullopt}};
+        if (hasChroma) {
+            step.parameters.chroma = chroma;
+        }
+        steps->append(step);
+    }
+    *gridSize = size;
+    return true;
+}
+
+static QByteArray chainKey(const QList<KColorTransform::Step> &steps, int gridSize)
+{
+    QByteArray key;
+    QDataStream stream(&key, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_6_0);
+    writeChain(stream, steps, gridSize);
+    return key;
+}
+
+namespace
+{
+struct TransformCache {
+    QMutex mutex;
+    QCache<QByteArray, KColorTransform> transforms{cacheLimit};
+};
+}
+
+Q_GLOBAL_STATIC(TransformCache, transformCache)
+
+static void addToCache(const QByteArray &key, const KColorTransform &transform)
+{
+    TransformCache *cache = transformCache();
+    if (!cache) {
+        // Already destroyed, at the exit of the process
+        return;
+    }
+    const qsizetype cost = qsizetype(transform.gridSize()) * transform.gridSize() * transform.gridSize() * 3 * sizeof(quint16);
+    QMutexLocker locker(&cache->mutex);
+    cache->transforms.insert(key, new KColorTransform(transform), cost);
+}
+
+KColorTransform::KColorTransform()
+    : d(new KColorTransformPrivate)
+{
+}
+
+KColorTransform::KColorTransform(const QList<Step> &steps, int gridSize)
+    : d(new KColorTransformPrivate)
+{
+    d->steps = steps;
+    d->gridSize = boundedGridSize(gridSize);
+    d->computeTable();
+    d->initInterpolation();
+}
+
+KColorTransform::KColorTransform(const KColorTransform &) = default;
+
+KColorTransform::~KColorTransform() = default;
+
+KColorTransform &KColorTransform::operator=(const KColorTransform &) = default;
+
+bool KColorTransform::isNull() const
+{
+    return d->table.empty();
+}
+
+QList<KColorTransform::Step> KColorTransform::steps() const
+{
+    return d->steps;
+}
+
+int KColorTransform::gridSize() const
+{
+    return d->gridSize;
+}
+
+QRgb KColorTransform::map(QRgb color) const
+{
+    return isNull() ? color : d->map(color);
+}
+
+void KColorTransform::apply(QImage &image) const
+{
+    if (isNull() || image.isNull()) {
+        return;
+    }
+    switch (image.format()) {
+    case QImage::Format_ARGB32_Premultiplied:
+    case QImage::Format_ARGB32:
+    case QImage::Format_RGB32:
+        break;
+    default:
+        image.convertTo(image.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32);
+        break;
+    }
+
+    // Images tend to repeat colors many times in a row, so the result for the
+    // previous color is reused when possible
+    const bool premultiplied = image.format() == QImage::Format_ARGB32_Premultiplied;
+    const KColorTransformPrivate *const data = d.constData();
+    QRgb previousColor = 0;
+    QRgb previousResult = 0;
+    bool havePrevious = false;
+    for (int y = 0; y < image.height(); ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+        for (int x = 0; x < image.width(); ++x) {
+            const QRgb color = line[x];
+            if (!havePrevious || color != previousColor) {
+                if (!premultiplied) {
+                    previousResult = data->map(color);
+                } else if (qAlpha(color) == 0) {
+                    previousResult = color;
+                } else {
+                    previousResult = qPremultiply(data->map(qUnpremultiply(color)));
+                }
+                previousColor = color;
+                havePrevious = true;
+            }
+            line[x] = previousResult;
+        }
+    }
+}
+
+QByteArray KColorTransform::toByteArray() const
+{
+    if (isNull()) {
+        return QByteArray();
+    }
+
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_6_0);
+    stream << serializationMagic << serializationVersion;
+    writeChain(stream, d->steps, d->gridSize);
+    for (quint16 value : d->table) {
+        stream << value;
+    }
+    return data;
+}
+
+KColorTransform KColorTransform::fromByteArray(const QByteArray &data)
+{
+    QDataStream stream(data);
+    stream.setVersion(QDataStream::Qt_6_0);
+    quint32 magic;
+    quint8 version;
+    stream >> magic >> version;
+    if (stream.status() != QDataStream::Ok || magic != serializationMagic || version != serializationVersion) {
+        return KColorTransform();
+    }
+
+    KColorTransform transform;
+    KColorTransformPrivate *const p = transform.d.data();
+    if (!readChain(stream, &p->steps, &p->gridSize)) {
+        return KColorTransform();
+    }
+    p->table.resize(size_t(p->gridSize) * p->gridSize * p->gridSize * 3);
+    for (quint16 &value : p->table) {
+        stream >> value;
+    }
+    if (stream.status() != QDataStream::Ok || !stream.atEnd()) {
+        return KColorTransform();
+    }
+    p->initInterpolation();
+
+    addToCache(chainKey(p->steps, p->gridSize), transform);
+    return transform;
+}
+
+KColorTransform KColorTransform::cached(const QList<Step> &steps, int gridSize)
+{
+    gridSize = boundedGridSize(gridSize);
+    const QByteArray key = chainKey(steps, gridSize);
+    if (TransformCache *cache = transformCache()) {
+        QMutexLocker locker(&cache->mutex);
+        if (const KColorTransform *transform = cache->transforms.object(key)) {
+            return *transform;
+        }
+    }
+
+    // Not holding the mutex, other threads may look up transforms meanwhile
+    const KColorTransform transform(steps, gridSize);
+    addToCache(key, transform);
+    return transform;
+}
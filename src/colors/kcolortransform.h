@@ -0,0 +1,141 @@
+/*
+    SPDX-FileCopyrightText: 2026 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef KCOLORTRANSFORM_H
+#define KCOLORTRANSFORM_H
+
+#include <kcolorutils.h>
+#include <kguiaddons_export.h>
+
+#include <QList>
+#include <QSharedDataPointer>
+
+class QByteArray;
+class QImage;
+class KColorTransformPrivate;
+
+/*!
+ * \class KColorTransform
+ * \inmodule KGuiAddons
+ * \brief A chain of KColorUtils adjustments, precomputed into a lookup table.
+ *
+ * Applying the same chain of adjustments, such as a tint followed by
+ * lighten() and mix(), to many colors or images repeats the same math for
+ * each pixel. KColorTransform computes the result of the chain once for a
+ * grid of gridSize() × gridSize() × gridSize() colors, and maps colors by
+ * trilinear interpolation between the eight grid points around them.
+ *
+ * The interpolation is an approximation. Most colors come out within a step
+ * or two of what the chain gives, but strongly saturated colors can be
+ * further off, as the adjustments in HCY space change fastest there. A grid
+ * size of 33 rather than 17 reduces the error.
+ *
+ * \code
+ *   const KColorTransform transform = KColorTransform::cached({
+ *       {KColorUtils::RecolorOperation::Tint, {accentColor, 0.4}},
+ *       {KColorUtils::RecolorOperation::Lighten, {QColor(), 0.2}},
+ *   });
+ *   for (QImage &icon : icons) {
+ *       transform.apply(icon);
+ *   }
+ * \endcode
+ *
+ * \since 6.30
+ */
+class KGUIADDONS_EXPORT KColorTransform
+{
+public:
+    /*!
+     * \struct KColorTransform::Step
+     * \inmodule KGuiAddons
+     *
+     * \brief One adjustment in the chain of a KColorTransform.
+     */
+    struct Step {
+        /*!
+         * \variable KColorTransform::Step::operation
+         * The adjustment, as for KColorUtils::recolorImage().
+         */
+        KColorUtils::RecolorOperation operation;
+        /*!
+         * \variable KColorTransform::Step::parameters
+         * The arguments of the adjustment.
+         */
+        KColorUtils::RecolorParameters parameters;
+    };
+
+    /*!
+     * Creates a null transform, which maps every color to itself.
+     */
+    KColorTransform();
+
+    /*!
+     * Creates a transform that applies each of \a steps in turn, computing a
+     * table of \a gridSize grid points along each of red, green and blue.
+     * \a gridSize is limited to the range from 2 to 65.
+     *
+     * \sa cached()
+     */
+    explicit KColorTransform(const QList<Step> &steps, int gridSize = 17);
+
+    KColorTransform(const KColorTransform &);
+    ~KColorTransform();
+    KColorTransform &operator=(const KColorTransform &);
+
+    /*!
+     * Returns whether this is a null transform.
+     */
+    bool isNull() const;
+
+    /*!
+     * Returns the adjustments that this transform applies.
+     */
+    QList<Step> steps() const;
+
+    /*!
+     * Returns the number of grid points along each axis of the table.
+     */
+    int gridSize() const;
+
+    /*!
+     * Returns \a color, which is not premultiplied, transformed. Its alpha is
+     * kept.
+     */
+    QRgb map(QRgb color) const;
+
+    /*!
+     * Transforms each pixel of \a image in place, handling formats as
+     * KColorUtils::recolorImage() does.
+     */
+    void apply(QImage &image) const;
+
+    /*!
+     * Returns the steps and the table of this transform, so that it can be
+     * stored, e.g. along with recolored icons, and restored with
+     * fromByteArray() without computing the table again.
+     */
+    QByteArray toByteArray() const;
+
+    /*!
+     * Returns the transform stored in \a data by toByteArray(), or a null
+     * transform if \a data doesn't hold one. The transform is added to the
+     * cache used by cached().
+     */
+    static KColorTransform fromByteArray(const QByteArray &data);
+
+    /*!
+     * Returns a transform for \a steps and \a gridSize, from a cache that is
+     * shared by all threads when possible. Otherwise the transform is created
+     * and added to the cache, which keeps the most recently used tables up to
+     * a few megabytes.
+     */
+    static KColorTransform cached(const QList<Step> &steps, int gridSize = 17);
+
+private:
+    QSharedDataPointer<KColorTransformPrivate> d;
+};
+
+#endif // KCOLORTRANSFORM_H
@@ -6,20 +6,147 @@
     SPDX-License-Identifier: LGPL-2.0-or-later
 */
 #include "kcolorspaces_p.h"
+#include "kcolorutils_p.h"
 #include "kguiaddons_colorhelpers_p.h"
-#include <kcolorutils.h>
 
+#include <QCache>
 #include <QColor>
 #include <QImage>
+#include <QMutex>
+#include <QThreadPool>
 #include <QtNumeric> // qIsNaN
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstring>
 #include <math.h>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
 
 // BEGIN internal helper functions
 static inline qreal mixQreal(qreal a, qreal b, qreal bias)
 {
     return a + (b - a) * bias;
 }
+
+/*
+ * Applies an adjustment in HCY space to each color. Palettes and images tend to
+ * repeat colors many times in a row, so the result for the previous color is
+ * reused when possible, as converting from and to HCY is expensive even in the
+ * single precision of KHCYF. colors and results may be the same.
+ */
+template<typename Adjust>
+static void adjustColors(std::span<const QRgb> colors, std::span<QRgb> results, Adjust adjust)
+{
+    Q_ASSERT(results.size() >= colors.size());
+    const size_t count = std::min(colors.size(), results.size());
+
+    QRgb previousColor = 0;
+    QRgb previousResult = 0;
+    bool havePrevious = false;
+    for (size_t i = 0; i < count; ++i) {
+        const QRgb color = colors[i];
+        if (!havePrevious || color != previousColor) {
+            KColorSpaces::KHCYF c(color);
+            adjust(c);
+            previousColor = color;
+            previousResult = c.rgba();
+            havePrevious = true;
+        }
+        results[i] = previousResult;
+    }
+}
+
+static void copyColors(std::span<const QRgb> colors, std::span<QRgb> results)
+{
+    const size_t count = std::min(colors.size(), results.size());
+    if (count && colors.data() != results.data()) {
+        memmove(results.data(), colors.data(), count * sizeof(QRgb));
+    }
+}
+
+namespace
+{
+enum class Derivation : quint8 {
+    Lighten,
+    Darken,
+    Shade,
+    Tint,
+    Mix,
+};
+
+struct DerivedColorKey {
+    Derivation derivation;
+    quint64 color1;
+    quint64 color2;
+    // The bits of the arguments, so that NaN can be found as well
+    quint64 argument1;
+    quint64 argument2;
+
+    bool operator==(const DerivedColorKey &other) const = default;
+};
+
+size_t qHash(const DerivedColorKey &key, size_t seed = 0)
+{
+    return qHashMulti(seed, quint8(key.derivation), key.color1, key.color2, key.argument1, key.argument2);
+}
+
+struct DerivedColorCache {
+    QMutex mutex;
+    QCache<DerivedColorKey, QColor> colors{0};
+    KColorUtils::CacheStatistics statistics;
+};
+
+// Checked before taking the mutex, so that derived colors cost nothing extra
+// while caching is off
+std::atomic<bool> derivedColorCaching = false;
+}
+
+Q_GLOBAL_STATIC(DerivedColorCache, derivedColorCache)
+
+/*
+ * Returns the result of derive() for the given arguments from the cache,
+ * or computes and caches it. Derivations of a single color pass it twice.
+ */
+template<typename Derive>
+static QColor derivedColor(Derivation derivation, const QColor &color1, const QColor &color2, qreal argument1, qreal argument2, Derive derive)
+{
+    // Only RGB colors, as the derivations may return one of the colors as is,
+    // and QColor::operator==() also compares the specs
+    if (!derivedColorCaching.load(std::memory_order_relaxed) || color1.spec() != QColor::Rgb || color2.spec() != QColor::Rgb) {
+        return derive();
+    }
+
+    DerivedColorCache *cache = derivedColorCache();
+    if (!cache) {
+        // Already destroyed, at the exit of the process
+        return derive();
+    }
+
+    const DerivedColorKey key{derivation,
+                              color1.rgba64(),
+                              color2.rgba64(),
+                              std::bit_cast<quint64>(double(argument1)),
+                              std::bit_cast<quint64>(double(argument2))};
+    {
+        QMutexLocker locker(&cache->mutex);
+        if (const QColor *color = cache->colors.object(key)) {
+            ++cache->statistics.hits;
+            return *color;
+        }
+        ++cache->statistics.misses;
+    }
+
+    // Not holding the mutex, other threads may derive colors meanwhile
+    const QColor result = derive();
+
+    QMutexLocker locker(&cache->mutex);
+    cache->colors.insert(key, new QColor(result));
+    return result;
+}
 // END internal helper functions
 
 qreal KColorUtils::hue(const QColor &color)
@@ -37,6 +164,11 @@ qreal KColorUtils::luma(const QColor &color)
     return KColorSpaces::KHCY::luma(color);
 }
 
+void KColorUtils::luma(const QRgb *colors, float *lumas, qsizetype count)
+{
+    KColorSpaces::KHCYF::luma({colors, size_t(count)}, {lumas, size_t(count)});
+}
+
 void KColorUtils::getHcy(const QColor &color, qreal *h, qreal *c, qreal *y, qreal *a)
 {
     if (!c || !h || !y) {
@@ -70,7 +202,101 @@ qreal KColorUtils::contrastRatio(const QColor &c1, const QColor &c2)
     return contrastRatioForLuma(luma(c1), luma(c2));
 }
 
-QColor KColorUtils::lighten(const QColor &color, qreal ky, qreal kc)
+// The luma of a background that black and white contrast with equally
+static const qreal evenContrastLuma = 0.1791287847; // sqrt(1.05 * 0.05) - 0.05
+
+/*
+ * Returns the luma closest to y that has a contrast ratio of at least minRatio
+ * with bgLuma, on the same side of bgLuma as y if possible. If minRatio can't
+ * be reached, returns 0.0 or 1.0, whichever contrasts more.
+ */
+static qreal contrastingLuma(qreal y, qreal bgLuma, qreal minRatio)
+{
+    const qreal lighter = minRatio * (bgLuma + 0.05) - 0.05;
+    const qreal darker = (bgLuma + 0.05) / minRatio - 0.05;
+    const bool canLighten = lighter <= 1.0;
+    const bool canDarken = darker >= 0.0;
+    const bool preferLighter = y > bgLuma || (y == bgLuma && bgLuma < evenContrastLuma);
+
+    if (canLighten && (preferLighter || !canDarken)) {
+        return qMax(y, lighter);
+    }
+    if (canDarken) {
+        return qMin(y, darker);
+    }
+    return bgLuma < evenContrastLuma ? 1.0 : 0.0;
+}
+
+/*
+ * Sets the luma of hcy to one contrasting with bgLuma by at least minRatio and
+ * returns the color converting it gives. Converting rounds the channels, which
+ * may cost a bit of contrast, so the luma is moved a bit further until the
+ * luma of the color, as lumaOf() gives it, is enough.
+ */
+template<typename HCY, typename Convert, typename Luma>
+static auto contrastingColor(HCY hcy, qreal bgLuma, qreal minRatio, Convert convert, Luma lumaOf)
+{
+    const qreal target = contrastingLuma(hcy.y, bgLuma, minRatio);
+    const qreal direction = target > hcy.y ? 1.0 : -1.0;
+    qreal nudge = 0.0;
+    for (;;) {
+        hcy.y = normalize(target + direction * nudge);
+        const auto result = convert(hcy);
+        if (hcy.y <= 0.0 || hcy.y >= 1.0 || nudge >= 0.05 || contrastRatioForLuma(lumaOf(result), bgLuma) >= minRatio) {
+            return result;
+        }
+        nudge = nudge > 0.0 ? nudge * 2.0 : 1e-5;
+    }
+}
+
+QColor KColorUtils::ensureContrast(const QColor &foreground, const QColor &background, qreal minRatio)
+{
+    const qreal bgLuma = luma(background);
+    const KColorSpaces::KHCY hcy(foreground);
+    if (!(contrastRatioForLuma(hcy.y, bgLuma) < minRatio)) {
+        // Also for a NaN minRatio
+        return foreground;
+    }
+
+    return contrastingColor(
+        hcy,
+        bgLuma,
+        minRatio,
+        [](const KColorSpaces::KHCY &c) {
+            return c.qColor();
+        },
+        [](const QColor &color) {
+            return luma(color);
+        });
+}
+
+void KColorUtils::ensureContrast(const QRgb *foregrounds, const QRgb *backgrounds, QRgb *results, qsizetype count, qreal minRatio)
+{
+    // The lumas in double precision, so that the results hold up to
+    // contrastRatio(); for 8-bit channels, they come from a table
+    const auto lumaOf = [](QRgb color) {
+        return KColorSpaces::KHCY::luma(QColor(color));
+    };
+    for (qsizetype i = 0; i < count; ++i) {
+        const QRgb foreground = foregrounds[i];
+        const qreal bgLuma = lumaOf(backgrounds[i]);
+        if (!(contrastRatioForLuma(lumaOf(foreground), bgLuma) < minRatio)) {
+            results[i] = foreground;
+            continue;
+        }
+
+        results[i] = contrastingColor(
+            KColorSpaces::KHCYF(foreground),
+            bgLuma,
+            minRatio,
+            [](const KColorSpaces::KHCYF &c) {
+                return c.rgba();
+            },
+            lumaOf);
+    }
+}
+
+static QColor lightenColor(const QColor &color, qreal ky, qreal kc)
 {
     KColorSpaces::KHCY c(color);
     c.y = 1.0 - normalize((1.0 - c.y) * (1.0 - ky));
@@ -78,7 +304,22 @@ QColor KColorUtils::lighten(const QColor &color, qreal ky, qreal kc)
     return c.qColor();
 }
 
-QColor KColorUtils::darken(const QColor &color, qreal ky, qreal kc)
+QColor KColorUtils::lighten(const QColor &color, qreal ky, qreal kc)
+{
+    return derivedColor(Derivation::Lighten, color, color, ky, kc, [&] {
+        return lightenColor(color, ky, kc);
+    });
+}
+
+void KColorUtils::lighten(const QRgb *colors, QRgb *results, qsizetype count, qreal ky, qreal kc)
+{
+    adjustColors({colors, size_t(count)}, {results, size_t(count)}, [ky, kc](KColorSpaces::KHCYF &c) {
+        c.y = 1.0 - normalize((1.0 - c.y) * (1.0 - ky));
+        c.c = 1.0 - normalize((1.0 - c.c) * kc);
+    });
+}
+
+static QColor darkenColor(const QColor &color, qreal ky, qreal kc)
 {
     KColorSpaces::KHCY c(color);
     c.y = normalize(c.y * (1.0 - ky));
@@ -86,7 +327,22 @@ QColor KColorUtils::darken(const QColor &color, qreal ky, qreal kc)
     return c.qColor();
 }
 
-QColor KColorUtils::shade(const QColor &color, qreal ky, qreal kc)
+QColor KColorUtils::darken(const QColor &color, qreal ky, qreal kc)
+{
+    return derivedColor(Derivation::Darken, color, color, ky, kc, [&] {
+        return darkenColor(color, ky, kc);
+    });
+}
+
+void KColorUtils::darken(const QRgb *colors, QRgb *results, qsizetype count, qreal ky, qreal kc)
+{
+    adjustColors({colors, size_t(count)}, {results, size_t(count)}, [ky, kc](KColorSpaces::KHCYF &c) {
+        c.y = normalize(c.y * (1.0 - ky));
+        c.c = normalize(c.c * kc);
+    });
+}
+
+static QColor shadeColor(const QColor &color, qreal ky, qreal kc)
 {
     KColorSpaces::KHCY c(color);
     c.y = normalize(c.y + ky);
@@ -94,9 +350,48 @@ QColor KColorUtils::shade(const QColor &color, qreal ky, qreal kc)
     return c.qColor();
 }
 
+QColor KColorUtils::shade(const QColor &color, qreal ky, qreal kc)
+{
+    return derivedColor(Derivation::Shade, color, color, ky, kc, [&] {
+        return shadeColor(color, ky, kc);
+    });
+}
+
+void KColorUtils::shade(const QRgb *colors, QRgb *results, qsizetype count, qreal ky, qreal kc)
+{
+    adjustColors({colors, size_t(count)}, {results, size_t(count)}, [ky, kc](KColorSpaces::KHCYF &c) {
+        c.y = normalize(c.y + ky);
+        c.c = normalize(c.c + kc);
+    });
+}
+
+static QColor mixColors(const QColor &c1, const QColor &c2, qreal bias)
+{
+    if (bias <= 0.0) {
+        return c1;
+    }
+    if (bias >= 1.0) {
+        return c2;
+    }
+    if (qIsNaN(bias)) {
+        return c1;
+    }
+
+    qreal a = mixQreal(c1.alphaF(), c2.alphaF(), bias);
+    if (a <= 0.0) {
+        return Qt::transparent;
+    }
+
+    qreal r = qBound(0.0, mixQreal(c1.redF() * c1.alphaF(), c2.redF() * c2.alphaF(), bias), 1.0) / a;
+    qreal g = qBound(0.0, mixQreal(c1.greenF() * c1.alphaF(), c2.greenF() * c2.alphaF(), bias), 1.0) / a;
+    qreal b = qBound(0.0, mixQreal(c1.blueF() * c1.alphaF(), c2.blueF() * c2.alphaF(), bias), 1.0) / a;
+
+    return QColor::fromRgbF(r, g, b, a);
+}
+
 static KColorSpaces::KHCY tintHelper(const QColor &base, qreal baseLuma, const QColor &color, qreal amount)
 {
-    KColorSpaces::KHCY result(KColorUtils::mix(base, color, pow(amount, 0.3)));
+    KColorSpaces::KHCY result(mixColors(base, color, pow(amount, 0.3)));
     result.y = mixQreal(baseLuma, result.y, amount);
 
     return result;
@@ -104,13 +399,13 @@ static KColorSpaces::KHCY tintHelper(const QColor &base, qreal baseLuma, const Q
 
 static qreal tintHelperLuma(const QColor &base, qreal baseLuma, const QColor &color, qreal amount)
 {
-    qreal result(KColorUtils::luma(KColorUtils::mix(base, color, pow(amount, 0.3))));
+    qreal result(KColorUtils::luma(mixColors(base, color, pow(amount, 0.3))));
     result = mixQreal(baseLuma, result, amount);
 
     return result;
 }
 
-QColor KColorUtils::tint(const QColor &base, const QColor &color, qreal amount)
+static QColor tintColors(const QColor &base, const QColor &color, qreal amount)
 {
     if (amount <= 0.0) {
         return base;
@@ -122,60 +417,466 @@ QColor KColorUtils::tint(const QColor &base, const QColor &color, qreal amount)
         return base;
     }
 
-    qreal baseLuma = luma(base); // cache value because luma call is expensive
-    double ri = contrastRatioForLuma(baseLuma, luma(color));
+    qreal baseLuma = KColorUtils::luma(base); // cache value because luma call is expensive
+    qreal colorLuma = KColorUtils::luma(color);
+    double ri = contrastRatioForLuma(baseLuma, colorLuma);
     double rg = 1.0 + ((ri + 1.0) * amount * amount * amount);
-    double u = 1.0;
-    double l = 0.0;
-    double a = 0.5;
-    for (int i = 12; i; --i) {
-        a = 0.5 * (l + u);
-        qreal resultLuma = tintHelperLuma(base, baseLuma, color, a);
-        double ra = contrastRatioForLuma(baseLuma, resultLuma);
-        if (ra > rg) {
+
+    // Look for the step of 1/2048 of the amount of color in which the contrast
+    // ratio starts to exceed rg, and use its middle. That is what a bisection in
+    // 12 iterations gives, but interpolating between the lumas on either side of
+    // the goal luma finds the step in about four evaluations.
+    const int direction = colorLuma > baseLuma ? 1 : -1;
+    const double goalLuma = direction > 0 ? rg * (baseLuma + 0.05) - 0.05 : (baseLuma + 0.05) / rg - 0.05;
+    const int steps = 2048;
+    int l = 0; // the ratio is at most rg here
+    int u = steps; // and exceeds it here, which color itself counts as
+    double ld = direction * (baseLuma - goalLuma);
+    double ud = direction * (colorLuma - goalLuma);
+    int moved = 0; // whether the last evaluation moved l (1) or u (-1)
+    for (int i = 0; u - l > 1; ++i) {
+        int a;
+        if (i == 0) {
+            // When the ratio crosses rg more than once, this makes it likely to
+            // pick the same crossing as the bisection
+            a = (l + u) / 2;
+        } else if (ud <= 0.0 && u == steps) {
+            // rg is out of reach, which should end right before color
+            a = steps - 1;
+        } else if (i <= 8 && ld < 0.0 && ud > 0.0) {
+            // Illinois variant of regula falsi, which avoids getting stuck at one end
+            a = qBound(l + 1, qRound((l * ud - u * ld) / (ud - ld)), u - 1);
+        } else {
+            a = (l + u) / 2;
+        }
+
+        qreal resultLuma = tintHelperLuma(base, baseLuma, color, qreal(a) / steps);
+        double d = direction * (resultLuma - goalLuma);
+        if (contrastRatioForLuma(baseLuma, resultLuma) > rg) {
+            if (moved < 0) {
+                ld *= 0.5;
+            }
             u = a;
+            ud = d;
+            moved = -1;
         } else {
+            if (moved > 0) {
+                ud *= 0.5;
+            }
             l = a;
+            ld = d;
+            moved = 1;
         }
     }
-    return tintHelper(base, baseLuma, color, a).qColor();
+    return tintHelper(base, baseLuma, color, (l + 0.5) / steps).qColor();
+}
+
+QColor KColorUtils::tint(const QColor &base, const QColor &color, qreal amount)
+{
+    return derivedColor(Derivation::Tint, base, color, amount, 0.0, [&] {
+        return tintColors(base, color, amount);
+    });
 }
 
 QColor KColorUtils::mix(const QColor &c1, const QColor &c2, qreal bias)
 {
-    if (bias <= 0.0) {
-        return c1;
+    return derivedColor(Derivation::Mix, c1, c2, bias, 0.0, [&] {
+        return mixColors(c1, c2, bias);
+    });
+}
+
+void KColorUtils::mix(const QRgb *colors1, const QRgb *colors2, QRgb *results, qsizetype count, qreal bias)
+{
+    if (bias <= 0.0 || qIsNaN(bias)) {
+        copyColors({colors1, size_t(count)}, {results, size_t(count)});
+        return;
     }
     if (bias >= 1.0) {
-        return c2;
+        copyColors({colors2, size_t(count)}, {results, size_t(count)});
+        return;
     }
-    if (qIsNaN(bias)) {
-        return c1;
+
+    // KColorMath::mix() does the same computation as mix() for QColors,
+    // without creating any. It only involves arithmetic, so that compilers
+    // can vectorize it.
+    for (qsizetype i = 0; i < count; ++i) {
+        results[i] = KColorMath::mix(colors1[i], colors2[i], bias);
     }
+}
 
-    qreal a = mixQreal(c1.alphaF(), c2.alphaF(), bias);
-    if (a <= 0.0) {
-        return Qt::transparent;
+/*
+ * Recolors the rows from first to last (exclusive) of an image in one of the
+ * formats recolorImage() handles, by unpremultiplying each row if needed and
+ * passing it through the batch functions.
+ */
+static void recolorRows(uchar *bits,
+                        qsizetype bytesPerLine,
+                        int width,
+                        int first,
+                        int last,
+                        bool premultiplied,
+                        KColorUtils::RecolorOperation operation,
+                        const KColorUtils::RecolorParameters &parameters)
+{
+    std::vector<QRgb> colors(width);
+    std::vector<QRgb> paints;
+    QHash<QRgb, QRgb> tinted; // tint() is expensive, and the colors of icons repeat a lot
+    const QRgb paint = parameters.color.rgb() & RGB_MASK;
+
+    for (int y = first; y < last; ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(bits + y * bytesPerLine);
+        for (int x = 0; x < width; ++x) {
+            colors[x] = premultiplied ? qUnpremultiply(line[x]) : line[x];
+        }
+
+        switch (operation) {
+        case KColorUtils::RecolorOperation::Lighten:
+            KColorUtils::lighten(colors.data(), colors.data(), width, parameters.amount, parameters.chroma.value_or(1.0));
+            break;
+        case KColorUtils::RecolorOperation::Darken:
+            KColorUtils::darken(colors.data(), colors.data(), width, parameters.amount, parameters.chroma.value_or(1.0));
+            break;
+        case KColorUtils::RecolorOperation::Shade:
+            KColorUtils::shade(colors.data(), colors.data(), width, parameters.amount, parameters.chroma.value_or(0.0));
+            break;
+        case KColorUtils::RecolorOperation::Mix:
+            // With the alpha of each pixel, which mixing then keeps
+            paints.resize(width);
+            for (int x = 0; x < width; ++x) {
+                paints[x] = paint | (colors[x] & ~RGB_MASK);
+            }
+            KColorUtils::mix(colors.data(), paints.data(), colors.data(), width, parameters.amount);
+            break;
+        case KColorUtils::RecolorOperation::Tint:
+            for (QRgb &color : colors) {
+                if (qAlpha(color) == 0) {
+                    continue;
+                }
+                auto it = tinted.constFind(color);
+                if (it == tinted.constEnd()) {
+                    const QRgb alpha = color & ~RGB_MASK;
+                    it = tinted.insert(color, tintColors(QColor::fromRgba(color), QColor::fromRgba(paint | alpha), parameters.amount).rgba());
+                }
+                color = *it;
+            }
+            break;
+        }
+
+        for (int x = 0; x < width; ++x) {
+            line[x] = premultiplied ? qPremultiply(colors[x]) : colors[x];
+        }
     }
+}
 
-    qreal r = qBound(0.0, mixQreal(c1.redF() * c1.alphaF(), c2.redF() * c2.alphaF(), bias), 1.0) / a;
-    qreal g = qBound(0.0, mixQreal(c1.greenF() * c1.alphaF(), c2.greenF() * c2.alphaF(), bias), 1.0) / a;
-    qreal b = qBound(0.0, mixQreal(c1.blueF() * c1.alphaF(), c2.blueF() * c2.alphaF(), bias), 1.0) / a;
+QColor KColorUtils::recolor(const QColor &color, RecolorOperation operation, const RecolorParameters &parameters)
+{
+    QColor paint = parameters.color.toRgb();
+    paint.setAlphaF(color.alphaF());
 
-    return QColor::fromRgbF(r, g, b, a);
+    switch (operation) {
+    case RecolorOperation::Lighten:
+        return lightenColor(color, parameters.amount, parameters.chroma.value_or(1.0));
+    case RecolorOperation::Darken:
+        return darkenColor(color, parameters.amount, parameters.chroma.value_or(1.0));
+    case RecolorOperation::Shade:
+        return shadeColor(color, parameters.amount, parameters.chroma.value_or(0.0));
+    case RecolorOperation::Tint:
+        return tintColors(color, paint, parameters.amount);
+    case RecolorOperation::Mix:
+        return mixColors(color, paint, parameters.amount);
+    }
+    return color;
+}
+
+void KColorUtils::recolorImage(QImage &image, RecolorOperation operation, const RecolorParameters &parameters)
+{
+    if (image.isNull()) {
+        return;
+    }
+    switch (image.format()) {
+    case QImage::Format_ARGB32_Premultiplied:
+    case QImage::Format_ARGB32:
+    case QImage::Format_RGB32:
+        break;
+    default:
+        image.convertTo(image.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32);
+        break;
+    }
+
+    const bool premultiplied = image.format() == QImage::Format_ARGB32_Premultiplied;
+    uchar *bits = image.bits();
+    const qsizetype bytesPerLine = image.bytesPerLine();
+    const int width = image.width();
+    const int height = image.height();
+    const auto recolor = [=, &parameters](int first, int last) {
+        recolorRows(bits, bytesPerLine, width, first, last, premultiplied, operation, parameters);
+    };
+
+    // Below this, starting another thread costs more than it saves
+    static constexpr int minimumChunkPixels = 16384;
+    const int chunkRows = qMax(1, minimumChunkPixels / width);
+    const int chunks = (height + chunkRows - 1) / chunkRows;
+    QThreadPool *pool = QThreadPool::globalInstance();
+    const int helpers = qMin(chunks, pool->maxThreadCount()) - 1;
+    if (helpers <= 0) {
+        recolor(0, height);
+        return;
+    }
+
+    // Whoever comes first claims the next chunk, this thread included. So this
+    // thread only ever waits for chunks being worked on, not for helpers that
+    // didn't start yet because the pool is busy. Those find nothing left to do.
+    struct Progress {
+        std::atomic<int> next = 0;
+        std::atomic<int> done = 0;
+    };
+    const auto progress = std::make_shared<Progress>();
+    const auto work = [progress, recolor, chunks, chunkRows, height] {
+        for (int chunk = progress->next++; chunk < chunks; chunk = progress->next++) {
+            recolor(chunk * chunkRows, qMin(height, (chunk + 1) * chunkRows));
+            if (++progress->done == chunks) {
+                progress->done.notify_all();
+            }
+        }
+    };
+    for (int i = 0; i < helpers; ++i) {
+        pool->start(work);
+    }
+    work();
+    for (int done = progress->done; done < chunks; done = progress->done) {
+        progress->done.wait(done);
+    }
+}
+
+/*
+ * Composition of premultiplied colors, giving exactly what the raster paint
+ * engine gives when filling a QImage::Format_ARGB32_Premultiplied with a
+ * solid color, so it uses the same integer approximations as Qt does.
+ */
+static inline int div255(int x)
+{
+    return (x + (x >> 8) + 0x80) >> 8;
+}
+
+// x * a / 255 for each channel
+static inline QRgb byteMul(QRgb x, uint a)
+{
+    uint t = (x & 0xff00ff) * a;
+    t = ((t + ((t >> 8) & 0xff00ff) + 0x800080) >> 8) & 0xff00ff;
+    x = ((x >> 8) & 0xff00ff) * a;
+    x = (x + ((x >> 8) & 0xff00ff) + 0x800080) & 0xff00ff00;
+    return x | t;
+}
+
+// (x * a + y * b) / 255 for each channel
+static inline QRgb interpolate255(QRgb x, uint a, QRgb y, uint b)
+{
+    uint t = (x & 0xff00ff) * a + (y & 0xff00ff) * b;
+    t = ((t + ((t >> 8) & 0xff00ff) + 0x800080) >> 8) & 0xff00ff;
+    x = ((x >> 8) & 0xff00ff) * a + ((y >> 8) & 0xff00ff) * b;
+    x = (x + ((x >> 8) & 0xff00ff) + 0x800080) & 0xff00ff00;
+    return x | t;
+}
+
+static inline int multiplyOp(int dst, int src, int da, int sa)
+{
+    return div255(src * dst + src * (255 - da) + dst * (255 - sa));
+}
+
+static inline int screenOp(int dst, int src, int, int)
+{
+    return 255 - div255((255 - dst) * (255 - src));
+}
+
+static inline int overlayOp(int dst, int src, int da, int sa)
+{
+    const int temp = src * (255 - da) + dst * (255 - sa);
+    if (2 * dst < da) {
+        return div255(2 * src * dst + temp);
+    }
+    return div255(sa * da - 2 * (da - dst) * (sa - src) + temp);
+}
+
+static inline int darkenOp(int dst, int src, int da, int sa)
+{
+    const int temp = src * (255 - da) + dst * (255 - sa);
+    return div255(qMin(src * da, dst * sa) + temp);
+}
+
+static inline int lightenOp(int dst, int src, int da, int sa)
+{
+    const int temp = src * (255 - da) + dst * (255 - sa);
+    return div255(qMax(src * da, dst * sa) + temp);
+}
+
+static inline int colorDodgeOp(int dst, int src, int da, int sa)
+{
+    const int temp = src * (255 - da) + dst * (255 - sa);
+    if (src * da + dst * sa > sa * da) {
+        return div255(sa * da + temp);
+    } else if (src == sa || sa == 0) {
+        return div255(temp);
+    }
+    return div255(255 * dst * sa / (255 - 255 * src / sa) + temp);
+}
+
+static inline int colorBurnOp(int dst, int src, int da, int sa)
+{
+    const int temp = src * (255 - da) + dst * (255 - sa);
+    if (src * da + dst * sa < sa * da) {
+        return div255(temp);
+    } else if (src == 0) {
+        return div255(dst * sa + temp);
+    }
+    return div255(sa * (src * da + dst * sa - sa * da) / src + temp);
+}
+
+static inline int hardLightOp(int dst, int src, int da, int sa)
+{
+    const int temp = src * (255 - da) + dst * (255 - sa);
+    if (2 * src < sa) {
+        return div255(2 * src * dst + temp);
+    }
+    return div255(sa * da - 2 * (da - dst) * (sa - src) + temp);
+}
+
+static inline int softLightOp(int dst, int src, int da, int sa)
+{
+    const int src2 = src * 2;
+    const int dstNp = da != 0 ? (255 * dst) / da : 0;
+    const int temp = (src * (255 - da) + dst * (255 - sa)) * 255;
+    if (src2 < sa) {
+        return (dst * (sa * 255 + (src2 - sa) * (255 - dstNp)) + temp) / 65025;
+    } else if (4 * dst <= da) {
+        return (dst * sa * 255 + da * (src2 - sa) * ((((16 * dstNp - 12 * 255) * dstNp + 3 * 65025) * dstNp) / 65025) + temp) / 65025;
+    }
+    return (dst * sa * 255 + da * (src2 - sa) * (int(sqrt(qreal(dstNp * 255))) - dstNp) + temp) / 65025;
+}
+
+static inline int differenceOp(int dst, int src, int da, int sa)
+{
+    return src + dst - div255(2 * qMin(src * da, dst * sa));
+}
+
+static inline int exclusionOp(int dst, int src, int, int)
+{
+    return src + dst - div255(2 * src * dst);
+}
+
+// The separable blend modes apply the same operation to each color channel
+template<int (*op)(int dst, int src, int da, int sa)>
+static inline QRgb blendChannels(QRgb dst, QRgb src)
+{
+    const int da = qAlpha(dst);
+    const int sa = qAlpha(src);
+    return qRgba(op(qRed(dst), qRed(src), da, sa),
+                 op(qGreen(dst), qGreen(src), da, sa),
+                 op(qBlue(dst), qBlue(src), da, sa),
+                 255 - div255((255 - sa) * (255 - da)));
+}
+
+static std::optional<QRgb> compose(QRgb dst, QRgb src, QPainter::CompositionMode mode)
+{
+    switch (mode) {
+    case QPainter::CompositionMode_SourceOver:
+        return src + byteMul(dst, qAlpha(~src));
+    case QPainter::CompositionMode_DestinationOver:
+        return dst + byteMul(src, qAlpha(~dst));
+    case QPainter::CompositionMode_Clear:
+        return 0;
+    case QPainter::CompositionMode_Source:
+        return src;
+    case QPainter::CompositionMode_Destination:
+        return dst;
+    case QPainter::CompositionMode_SourceIn:
+        return byteMul(src, qAlpha(dst));
+    case QPainter::CompositionMode_DestinationIn:
+        return byteMul(dst, qAlpha(src));
+    case QPainter::CompositionMode_SourceOut:
+        return byteMul(src, qAlpha(~dst));
+    case QPainter::CompositionMode_DestinationOut:
+        return byteMul(dst, qAlpha(~src));
+    case QPainter::CompositionMode_SourceAtop:
+        return interpolate255(src, qAlpha(dst), dst, qAlpha(~src));
+    case QPainter::CompositionMode_DestinationAtop:
+        return interpolate255(dst, qAlpha(src), src, qAlpha(~dst));
+    case QPainter::CompositionMode_Xor:
+        return interpolate255(src, qAlpha(~dst), dst, qAlpha(~src));
+    case QPainter::CompositionMode_Plus:
+        return qRgba(qMin(qRed(dst) + qRed(src), 255),
+                     qMin(qGreen(dst) + qGreen(src), 255),
+                     qMin(qBlue(dst) + qBlue(src), 255),
+                     qMin(qAlpha(dst) + qAlpha(src), 255));
+    case QPainter::CompositionMode_Multiply:
+        return blendChannels<multiplyOp>(dst, src);
+    case QPainter::CompositionMode_Screen:
+        return blendChannels<screenOp>(dst, src);
+    case QPainter::CompositionMode_Overlay:
+        return blendChannels<overlayOp>(dst, src);
+    case QPainter::CompositionMode_Darken:
+        return blendChannels<darkenOp>(dst, src);
+    case QPainter::CompositionMode_Lighten:
+        return blendChannels<lightenOp>(dst, src);
+    case QPainter::CompositionMode_ColorDodge:
+        return blendChannels<colorDodgeOp>(dst, src);
+    case QPainter::CompositionMode_ColorBurn:
+        return blendChannels<colorBurnOp>(dst, src);
+    case QPainter::CompositionMode_HardLight:
+        return blendChannels<hardLightOp>(dst, src);
+    case QPainter::CompositionMode_SoftLight:
+        return blendChannels<softLightOp>(dst, src);
+    case QPainter::CompositionMode_Difference:
+        return blendChannels<differenceOp>(dst, src);
+    case QPainter::CompositionMode_Exclusion:
+        return blendChannels<exclusionOp>(dst, src);
+    default:
+        // The raster operations
+        return std::nullopt;
+    }
 }
 
 QColor KColorUtils::overlayColors(const QColor &base, const QColor &paint, QPainter::CompositionMode comp)
 {
+    QColor start = base;
+    start.setAlpha(255); // opaque
+
+    // The raster paint engine premultiplies the 16-bit channels of fill colors
+    if (const auto pixel = compose(start.rgba64().premultiplied().toArgb32(), paint.rgba64().premultiplied().toArgb32(), comp)) {
+        return qUnpremultiply(*pixel);
+    }
+
     // This isn't the fastest way, but should be "fast enough".
     // It's also the only safe way to use QPainter::CompositionMode
     QImage img(1, 1, QImage::Format_ARGB32_Premultiplied);
     QPainter p(&img);
-    QColor start = base;
-    start.setAlpha(255); // opaque
     p.fillRect(0, 0, 1, 1, start);
     p.setCompositionMode(comp);
     p.fillRect(0, 0, 1, 1, paint);
     p.end();
     return img.pixel(0, 0);
 }
+
+void KColorUtils::setCacheSize(int colors)
+{
+    QMutexLocker locker(&derivedColorCache->mutex);
+    derivedColorCache->colors.setMaxCost(qMax(0, colors));
+    derivedColorCaching.store(colors > 0, std::memory_order_relaxed);
+}
+
+int KColorUtils::cacheSize()
+{
+    QMutexLocker locker(&derivedColorCache->mutex);
+    return derivedColorCache->colors.maxCost();
+}
+
+KColorUtils::CacheStatistics KColorUtils::cacheStatistics()
+{
+    QMutexLocker locker(&derivedColorCache->mutex);
+    return derivedColorCache->statistics;
+}
+
+void KColorUtils::resetCacheStatistics()
+{
+    QMutexLocker locker(&derivedColorCache->mutex);
+    derivedColorCache->statistics = {};
+}
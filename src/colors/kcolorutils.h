@@ -11,9 +11,12 @@
 
 #include <kguiaddons_export.h>
 
+#include <QColor>
 #include <QPainter>
 
-class QColor;
+#include <optional>
+
+class QImage;
 
 // TODO KF7: turn this into a Q_GADGET class with static members to avoid the need for the KColorUtilsSingleton QML wrapper
 
@@ -59,6 +62,18 @@ KGUIADDONS_EXPORT qreal chroma(const QColor &);
  */
 KGUIADDONS_EXPORT qreal luma(const QColor &);
 
+/*!
+ * Calculate the luma of the \a count colors at \a colors, as luma() does,
+ * and store it at the same position in \a lumas, e.g. for all pixels of an
+ * image in QImage::Format_ARGB32.
+ *
+ * This saves creating a QColor for each color. The lumas are computed in
+ * single precision, so they may differ from luma() in the last digit.
+ *
+ * \since 6.30
+ */
+KGUIADDONS_EXPORT void luma(const QRgb *colors, float *lumas, qsizetype count);
+
 /*!
  * Calculate hue, chroma and luma of a color in one call.
  *
@@ -99,6 +114,43 @@ KGUIADDONS_EXPORT QColor hcyColor(qreal hue, qreal chroma, qreal luma, qreal alp
  */
 KGUIADDONS_EXPORT qreal contrastRatio(const QColor &, const QColor &);
 
+/*!
+ * Returns \a foreground, changed as little as needed to have a contrast ratio
+ * of at least \a minRatio with \a background, as contrastRatio() computes
+ * it. Only the luma of \a foreground is changed, keeping its hue and
+ * chroma, and its alpha.
+ *
+ * If \a foreground is lighter than \a background, it is made lighter still,
+ * and darker if it is darker, unless only the other direction can reach
+ * \a minRatio. If neither can, the result is white or black, whichever
+ * contrasts more with \a background.
+ *
+ * \code
+ *   // Readable text, as in WCAG 2.0 level AA
+ *   const QColor text = KColorUtils::ensureContrast(linkColor, windowColor, 4.5);
+ * \endcode
+ *
+ * \sa contrastRatio()
+ * \since 6.30
+ */
+KGUIADDONS_EXPORT QColor ensureContrast(const QColor &foreground, const QColor &background, qreal minRatio);
+
+/*!
+ * Make each of the \a count colors at \a foregrounds contrast with the color
+ * at the same position in \a backgrounds, as ensureContrast() does with
+ * \a minRatio, and store the result at that position in \a results, e.g. for
+ * all pairs of text and background colors of a color scheme. \a results may
+ * point to the same memory as \a foregrounds.
+ *
+ * The colors are not premultiplied. The contrast ratio of the results with
+ * their backgrounds is at least \a minRatio when it can be reached, but the
+ * conversion is done in single precision, so a channel may differ by one
+ * from what ensureContrast() gives.
+ *
+ * \since 6.30
+ */
+KGUIADDONS_EXPORT void ensureContrast(const QRgb *foregrounds, const QRgb *backgrounds, QRgb *results, qsizetype count, qreal minRatio);
+
 /*!
  * Adjust the luma of a color by changing its distance from white.
  *
@@ -120,6 +172,21 @@ KGUIADDONS_EXPORT qreal contrastRatio(const QColor &, const QColor &);
  */
 KGUIADDONS_EXPORT QColor lighten(const QColor &, qreal amount = 0.5, qreal chromaInverseGain = 1.0);
 
+/*!
+ * Lighten the \a count colors at \a colors as lighten() does, and store the
+ * results at the same position in \a results. \a colors and \a results may
+ * point to the same memory, to modify colors in place.
+ *
+ * The colors are not premultiplied, like those of QImage::Format_ARGB32.
+ * Runs of the same color are only converted once, which helps with images
+ * and palettes that repeat colors. The conversion is done in single
+ * precision, so a channel of the result may differ by one from what
+ * lighten() gives.
+ *
+ * \since 6.30
+ */
+KGUIADDONS_EXPORT void lighten(const QRgb *colors, QRgb *results, qsizetype count, qreal amount = 0.5, qreal chromaInverseGain = 1.0);
+
 /*!
  * Adjust the luma of a color by changing its distance from black.
  *
@@ -139,6 +206,16 @@ KGUIADDONS_EXPORT QColor lighten(const QColor &, qreal amount = 0.5, qreal chrom
  */
 KGUIADDONS_EXPORT QColor darken(const QColor &, qreal amount = 0.5, qreal chromaGain = 1.0);
 
+/*!
+ * Darken the \a count colors at \a colors as darken() does, and store the
+ * results at the same position in \a results. \a colors and \a results may
+ * point to the same memory.
+ *
+ * \sa lighten(const QRgb *, QRgb *, qsizetype, qreal, qreal)
+ * \since 6.30
+ */
+KGUIADDONS_EXPORT void darken(const QRgb *colors, QRgb *results, qsizetype count, qreal amount = 0.5, qreal chromaGain = 1.0);
+
 /*!
  * Adjust the luma and chroma components of a color. The amount is added
  * to the corresponding component.
@@ -155,6 +232,16 @@ KGUIADDONS_EXPORT QColor darken(const QColor &, qreal amount = 0.5, qreal chroma
  */
 KGUIADDONS_EXPORT QColor shade(const QColor &, qreal lumaAmount, qreal chromaAmount = 0.0);
 
+/*!
+ * Shade the \a count colors at \a colors as shade() does, and store the
+ * results at the same position in \a results. \a colors and \a results may
+ * point to the same memory.
+ *
+ * \sa lighten(const QRgb *, QRgb *, qsizetype, qreal, qreal)
+ * \since 6.30
+ */
+KGUIADDONS_EXPORT void shade(const QRgb *colors, QRgb *results, qsizetype count, qreal lumaAmount, qreal chromaAmount = 0.0);
+
 /*!
  * Create a new color by tinting one color with another. This function is
  * meant for creating additional colors withings the same class (background,
@@ -188,6 +275,94 @@ KGUIADDONS_EXPORT QColor tint(const QColor &base, const QColor &color, qreal amo
  */
 KGUIADDONS_EXPORT QColor mix(const QColor &c1, const QColor &c2, qreal bias = 0.5);
 
+/*!
+ * Blend each of the \a count colors at \a colors1 with the color at the same
+ * position in \a colors2 as mix() does with \a bias, and store the result at
+ * that position in \a results. \a results may point to the same memory as
+ * either of \a colors1 and \a colors2.
+ *
+ * The colors are not premultiplied, like those of QImage::Format_ARGB32.
+ *
+ * \since 6.30
+ */
+KGUIADDONS_EXPORT void mix(const QRgb *colors1, const QRgb *colors2, QRgb *results, qsizetype count, qreal bias = 0.5);
+
+/*!
+ * \enum KColorUtils::RecolorOperation
+ *
+ * The adjustment that recolorImage() applies to each pixel.
+ *
+ * \value Lighten
+ *        lighten() by RecolorParameters::amount, with RecolorParameters::chroma
+ *        as chromaInverseGain
+ * \value Darken
+ *        darken() by RecolorParameters::amount, with RecolorParameters::chroma
+ *        as chromaGain
+ * \value Shade
+ *        shade() by RecolorParameters::amount, with RecolorParameters::chroma
+ *        as chromaAmount
+ * \value Tint
+ *        tint() with RecolorParameters::color by RecolorParameters::amount
+ * \value Mix
+ *        mix() with RecolorParameters::color, with RecolorParameters::amount
+ *        as bias
+ *
+ * \since 6.30
+ */
+enum class RecolorOperation {
+    Lighten,
+    Darken,
+    Shade,
+    Tint,
+    Mix,
+};
+
+/*!
+ * \struct KColorUtils::RecolorParameters
+ * \inmodule KGuiAddons
+ *
+ * \brief The arguments of the adjustment that recolorImage() applies.
+ *
+ * \sa RecolorOperation
+ * \since 6.30
+ */
+struct RecolorParameters {
+    /*!
+     * \variable KColorUtils::RecolorParameters::color
+     * The color to tint or mix the pixels with. Its alpha is ignored.
+     */
+    QColor color;
+    /*!
+     * \variable KColorUtils::RecolorParameters::amount
+     * The amount of the adjustment, or the bias for mixing.
+     */
+    qreal amount = 0.5;
+    /*!
+     * \variable KColorUtils::RecolorParameters::chroma
+     * The chroma argument of lighten(), darken() or shade(). When not set,
+     * the chroma is not changed, as by the default arguments of these.
+     */
+    std::optional<qreal> chroma;
+};
+
+/*!
+ * Apply \a operation with \a parameters to each pixel of \a image, as the
+ * function of the same name does for a QColor, e.g. to colorize an icon with
+ * the accent color. The alpha of each pixel is kept.
+ *
+ * The image is modified in place. QImage::Format_ARGB32_Premultiplied,
+ * QImage::Format_ARGB32 and QImage::Format_RGB32 are processed as they
+ * are, other formats are converted to one of them first. Large images are
+ * processed by several threads of QThreadPool::globalInstance().
+ *
+ * Lighten, Darken and Shade work in single precision, like the versions of
+ * lighten() etc. for arrays of colors, so a channel may differ by one from
+ * what the QColor versions give.
+ *
+ * \since 6.30
+ */
+KGUIADDONS_EXPORT void recolorImage(QImage &image, RecolorOperation operation, const RecolorParameters &parameters);
+
 /*!
  * Blend two colors into a new color by painting the second color over the
  * first using the specified composition mode.
@@ -204,6 +379,66 @@ KGUIADDONS_EXPORT QColor mix(const QColor &c1, const QColor &c2, qreal bias = 0.
  * \a comp the CompositionMode used to do the blending.
  */
 KGUIADDONS_EXPORT QColor overlayColors(const QColor &base, const QColor &paint, QPainter::CompositionMode comp = QPainter::CompositionMode_SourceOver);
+
+/*!
+ * \struct KColorUtils::CacheStatistics
+ * \inmodule KGuiAddons
+ *
+ * \brief How often the colors derived by KColorUtils were found in the cache.
+ *
+ * \sa setCacheSize()
+ * \since 6.30
+ */
+struct CacheStatistics {
+    /*!
+     * \variable KColorUtils::CacheStatistics::hits
+     * Number of derived colors that were found in the cache.
+     */
+    qint64 hits = 0;
+    /*!
+     * \variable KColorUtils::CacheStatistics::misses
+     * Number of derived colors that had to be computed.
+     */
+    qint64 misses = 0;
+};
+
+/*!
+ * Keep up to \a colors of the results of tint(), mix(), lighten(), darken()
+ * and shade() for QColors, so that asking for the same color with the same
+ * arguments again only takes a hash lookup. The least recently used colors
+ * are dropped first. The cache is shared by all threads.
+ *
+ * Caching is off by default, and \a colors of 0 turns it off again. This
+ * pays off for code that derives the same palette colors over and over,
+ * like themes do on every palette change.
+ *
+ * \sa cacheStatistics()
+ * \since 6.30
+ */
+KGUIADDONS_EXPORT void setCacheSize(int colors);
+
+/*!
+ * Returns how many derived colors are kept at most.
+ *
+ * \sa setCacheSize()
+ * \since 6.30
+ */
+KGUIADDONS_EXPORT int cacheSize();
+
+/*!
+ * Returns how often derived colors were found in the cache, since the
+ * start of the process or the last resetCacheStatistics().
+ *
+ * \since 6.30
+ */
+KGUIADDONS_EXPORT CacheStatistics cacheStatistics();
+
+/*!
+ * Resets the counters returned by cacheStatistics().
+ *
+ * \since 6.30
+ */
+KGUIADDONS_EXPORT void resetCacheStatistics();
 }
 
 #endif // KCOLORUTILS_H
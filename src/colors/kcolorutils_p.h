@@ -0,0 +1,22 @@
+/*
+    SPDX-FileCopyrightText: 2026 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef KCOLORUTILS_P_H
+#define KCOLORUTILS_P_H
+
+#include <kcolorutils.h>
+
+namespace KColorUtils
+{
+/*
+ * The adjustment that recolorImage() applies, for a single color in double
+ * precision. The alpha of color is kept, and the cache of derived colors is
+ * bypassed.
+ */
+QColor recolor(const QColor &color, RecolorOperation operation, const RecolorParameters &parameters);
+}
+
+#endif // KCOLORUTILS_P_H
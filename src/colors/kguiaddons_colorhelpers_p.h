@@ -8,11 +8,14 @@
 #ifndef KGUIADDONS_COLORHELPERS_P_H
 #define KGUIADDONS_COLORHELPERS_P_H
 
-// normalize: like qBound(a, 0.0, 1.0) but without needing the args and with
-// "safer" behavior on NaN (isnan(a) -> return 0.0)
-static inline qreal normalize(qreal a)
-{
-    return (a < 1.0 ? (a > 0.0 ? a : 0.0) : 1.0);
-}
+#include "kcolormath_p.h"
+
+// normalize: like qBound(a, 0.0, 1.0), but 0.0 for NaN
+// channelF: the component of a QColor created from an 8-bit value
+// channel8: the 8-bit component of a QColor created with QColor::fromRgbF()
+// All of them are constexpr, and shared with KColorMath.
+using KColorMathPrivate::channel8;
+using KColorMathPrivate::channelF;
+using KColorMathPrivate::normalize;
 
 #endif // KGUIADDONS_KCOLORHELPERS_P_H
@@ -21,8 +21,13 @@
 #include <klocalimagecacheimpl.h>
 #include <kshareddatacache.h>
 
+#include <QFuture>
+#include <QHash>
 #include <QImage>
 #include <QPixmap>
+#include <QStringList>
+
+#include <functional>
 
 #define KImageCache KSharedPixmapCacheMixin<KSharedDataCache>
 
@@ -78,8 +83,11 @@ public:
      */
     KSharedPixmapCacheMixin(const QString &cacheName, unsigned defaultCacheSize, unsigned expectedItemSize = 0)
         : T(cacheName, defaultCacheSize, expectedItemSize)
-        , KLocalImageCacheImplementation(defaultCacheSize)
+        , KLocalImageCacheImplementation(cacheName, defaultCacheSize)
     {
+        setSharedCacheWriter([this](const QString &key, const QByteArray &data) {
+            return this->insert(key, data);
+        });
     }
 
     /*!
@@ -94,17 +102,26 @@ public:
      *
      * \a pixmap The pixmap to add to the cache.
      *
+     * If a shared cache promotion threshold is set, \a pixmap is only stored in
+     * the local pixmap cache until it has been used often enough. An image that
+     * the shared cache holds for \a key already is replaced right away though,
+     * so that lookups don't keep finding the previous image.
+     *
      * Returns \c true if the pixmap was successfully cached, \c false otherwise.
      *
-     * \sa setPixmapCaching()
+     * \sa setPixmapCaching(), setSharedCachePromotionThreshold()
      */
     bool insertPixmap(const QString &key, const QPixmap &pixmap)
     {
-        insertLocalPixmap(key, pixmap);
+        discardPendingImage(key);
+
+        // Don't let pixmaps that are only ever used once evict the frequently
+        // used entries of other processes from the shared cache.
+        if (!admitToSharedCache(key) && !this->contains(key) && insertLocalOnlyPixmap(key, pixmap)) {
+            return true;
+        }
 
-        // One thing to think about is only inserting things to the shared cache
-        // that are frequently used. But that would require tracking the use count
-        // in our local cache too, which I think is probably too much work.
+        insertLocalPixmap(key, pixmap);
 
         return insertImage(key, pixmap.toImage());
     }
@@ -124,7 +141,10 @@ public:
      */
     bool insertImage(const QString &key, const QImage &image)
     {
-        if (this->insert(key, serializeImage(image))) {
+        // A decode that is still running would return the previous image
+        discardPendingImage(key);
+
+        if (insertSharedData(key, image)) {
             updateModifiedTime();
             return true;
         }
@@ -132,6 +152,35 @@ public:
         return false;
     }
 
+    /*!
+     * Inserts all of \a images into the shared cache, each accessible with its
+     * key in the hash. This is equivalent to calling insertImage() for every
+     * entry, but is cheaper for large batches such as a page of thumbnails.
+     *
+     * Returns \c true if all images were successfully cached, \c false otherwise.
+     *
+     * \since 6.30
+     */
+    bool insertImages(const QHash<QString, QImage> &images)
+    {
+        bool insertedAny = false;
+        bool insertedAll = true;
+        for (auto it = images.cbegin(); it != images.cend(); ++it) {
+            discardPendingImage(it.key());
+            if (insertSharedData(it.key(), it.value())) {
+                insertedAny = true;
+            } else {
+                insertedAll = false;
+            }
+        }
+
+        if (insertedAny) {
+            updateModifiedTime();
+        }
+
+        return insertedAll;
+    }
+
     /*!
      * Copies the cached pixmap identified by \a key to \a destination. If no such
      * pixmap exists \a destination is unchanged.
@@ -142,19 +191,23 @@ public:
     bool findPixmap(const QString &key, QPixmap *destination) const
     {
         if (findLocalPixmap(key, destination)) {
+            promotePixmap(key);
             return true;
         }
 
+        // An image that is being decoded in the background, e.g. because it has
+        // been prefetched, is decoded here again rather than waiting for the
+        // thread pool, which may be busy with unrelated jobs.
         QByteArray cachedData;
-        if (!this->find(key, &cachedData) || cachedData.isNull()) {
+        if (!findSharedData(key, &cachedData)) {
             return false;
         }
 
         if (destination) {
-            destination->loadFromData(cachedData, "PNG", Qt::NoOpaqueDetection);
+            *destination = QPixmap::fromImage(decodeSharedData(key, cachedData), Qt::NoOpaqueDetection);
 
             // Manually re-insert to pixmap cache if we'll be using this one.
-            insertLocalPixmap(key, *destination);
+            insertLocalPixmap(key, *destination, cachedData);
         }
 
         return true;
@@ -164,22 +217,290 @@ public:
      * Copies the cached image identified by \a key to \a destination. If no such
      * image exists \a destination is unchanged.
      *
+     * Images stored as StorageFormat::Raw are not copied again after having been
+     * read from the shared cache: \a destination then refers to read-only memory
+     * owned by the image itself, and is only copied if it gets modified.
+     *
      * Returns \c true if the image identified by \a key existed, \c false otherwise.
      */
     bool findImage(const QString &key, QImage *destination) const
     {
         QByteArray cachedData;
-        if (!this->find(key, &cachedData) || cachedData.isNull()) {
+        if (!findSharedData(key, &cachedData)) {
+            return false;
+        }
+
+        if (destination) {
+            *destination = decodeSharedData(key, cachedData);
+        }
+
+        return true;
+    }
+
+    /*!
+     * Inserts \a image as the variant of the image identified by \a key for its
+     * logical size and device pixel ratio. Unlike with insertImage(), several
+     * variants of the same image can be cached side by side, e.g. for screens
+     * with different scale factors, and be found with findImageVariant().
+     *
+     * Returns \c true if the image was successfully cached, \c false otherwise.
+     *
+     * \since 6.30
+     */
+    bool insertImageVariant(const QString &key, const QImage &image)
+    {
+        const QSize size = image.deviceIndependentSize().toSize();
+        if (!insertImage(variantKey(key, size, image.devicePixelRatio()), image)) {
+            return false;
+        }
+
+        registerVariant(key, size, image.devicePixelRatio());
+        return true;
+    }
+
+    /*!
+     * Inserts \a pixmap as the variant of the pixmap identified by \a key for
+     * its logical size and device pixel ratio, like insertImageVariant().
+     *
+     * Returns \c true if the pixmap was successfully cached, \c false otherwise.
+     *
+     * \sa findPixmapVariant()
+     * \since 6.30
+     */
+    bool insertPixmapVariant(const QString &key, const QPixmap &pixmap)
+    {
+        const QSize size = pixmap.deviceIndependentSize().toSize();
+        if (!insertPixmap(variantKey(key, size, pixmap.devicePixelRatio()), pixmap)) {
+            return false;
+        }
+
+        registerVariant(key, size, pixmap.devicePixelRatio());
+        return true;
+    }
+
+    /*!
+     * Copies the variant of the image identified by \a key with the logical
+     * \a size and \a devicePixelRatio to \a destination.
+     *
+     * If there is no such variant, the smallest cached variant that has at least
+     * as many pixels in both directions is scaled down instead, so that moving a
+     * window to a screen with a different scale factor doesn't require rendering
+     * the image again.
+     *
+     * Returns \c true if a suitable variant existed, \c false otherwise, in which
+     * case \a destination is unchanged.
+     *
+     * \sa insertImageVariant()
+     * \since 6.30
+     */
+    bool findImageVariant(const QString &key, const QSize &size, qreal devicePixelRatio, QImage *destination) const
+    {
+        QImage image;
+        if (!findImage(variantKey(key, size, devicePixelRatio), &image) && !findLargerVariant(key, size, devicePixelRatio, &image)) {
             return false;
         }
 
         if (destination) {
-            destination->loadFromData(cachedData, "PNG");
+            *destination = scaledVariant(image, size, devicePixelRatio);
         }
+        return true;
+    }
+
+    /*!
+     * Copies the variant of the pixmap identified by \a key with the logical
+     * \a size and \a devicePixelRatio to \a destination, falling back to
+     * scaling down a larger variant like findImageVariant().
+     *
+     * Returns \c true if a suitable variant existed, \c false otherwise, in which
+     * case \a destination is unchanged.
+     *
+     * \sa insertPixmapVariant()
+     * \since 6.30
+     */
+    bool findPixmapVariant(const QString &key, const QSize &size, qreal devicePixelRatio, QPixmap *destination) const
+    {
+        const QString exactKey = variantKey(key, size, devicePixelRatio);
+        QPixmap pixmap;
+        if (findPixmap(exactKey, &pixmap)) {
+            // The device pixel ratio doesn't survive being stored as PNG
+            pixmap.setDevicePixelRatio(devicePixelRatio);
+        } else {
+            QImage image;
+            QByteArray cachedData;
+            if (!findLargerVariant(key, size, devicePixelRatio, &image, &cachedData)) {
+                return false;
+            }
 
+            // The scaled pixmap goes stale along with the variant it was made of
+            pixmap = QPixmap::fromImage(scaledVariant(image, size, devicePixelRatio), Qt::NoOpaqueDetection);
+            insertLocalPixmap(exactKey, pixmap, cachedData);
+        }
+
+        if (destination) {
+            *destination = pixmap;
+        }
         return true;
     }
 
+    /*!
+     * Looks up the image identified by \a key, decoding it in a thread pool
+     * instead of on the calling thread. This keeps e.g. scrolling through a view
+     * of thumbnails smooth while the images are being decoded.
+     *
+     * Only copying the entry out of the shared cache happens synchronously.
+     * Concurrent requests for the same \a key share one decode. If pixmap caching
+     * is enabled, the decoded image is also added to the local pixmap cache, so
+     * that subsequent calls to findPixmap() can use it right away; that last step
+     * happens in the thread this cache was created in. Inserting another image
+     * with \a key while it is being decoded discards that decode: later requests
+     * start a new one, and the previous image doesn't end up in the local pixmap
+     * cache.
+     *
+     * Returns a future for the image, which holds a null QImage if no image
+     * identified by \a key exists.
+     *
+     * \sa findImage(), setPixmapCaching()
+     * \since 6.30
+     */
+    QFuture<QImage> findImageAsync(const QString &key) const
+    {
+        QFuture<QImage> future;
+        if (findPendingImage(key, &future)) {
+            return future;
+        }
+
+        QByteArray cachedData;
+        if (!findSharedData(key, &cachedData)) {
+            return QtFuture::makeReadyValueFuture(QImage());
+        }
+
+        return deserializeImageAsync(key, cachedData);
+    }
+
+    /*!
+     * Starts decoding the images identified by \a keys in a background thread,
+     * and stores them in the local pixmap cache once they have been decoded, so
+     * that later findPixmap() calls don't have to decode them anymore.
+     *
+     * Keys that are not in the cache, or that are in the local pixmap cache
+     * already, are skipped. This does nothing if pixmap caching is disabled.
+     *
+     * \sa setStartupPrefetching(), findImageAsync()
+     * \since 6.30
+     */
+    void prefetch(const QStringList &keys)
+    {
+        if (!pixmapCaching()) {
+            return;
+        }
+
+        for (const QString &key : keys) {
+            QFuture<QImage> future;
+            if (hasLocalPixmap(key) || findPendingImage(key, &future)) {
+                continue;
+            }
+
+            QByteArray cachedData;
+            if (this->find(key, &cachedData) && !cachedData.isNull() && !isStale(cachedData)) {
+                deserializeImageAsync(key, cachedData);
+            }
+        }
+    }
+
+    /*!
+     * Returns whether startup prefetching is enabled. The default is \c false.
+     *
+     * \sa setStartupPrefetching()
+     * \since 6.30
+     */
+#ifdef Q_QDOC
+    bool startupPrefetching() const;
+#else
+    using KLocalImageCacheImplementation::startupPrefetching;
+#endif
+
+    /*!
+     * Enables or disables startup prefetching, according to \a enable.
+     *
+     * Applications tend to look up the same images in the same order every time
+     * they start. When startup prefetching gets enabled, the keys looked up in
+     * this cache afterwards are recorded for the next run, until 512 different
+     * keys have been looked up or 10 seconds have passed. The keys recorded by
+     * the previous run are passed to prefetch() right away, so that they are
+     * decoded in the background while the application is still starting up.
+     *
+     * This should be enabled right after creating the cache, before the first
+     * lookup. The recorded keys are stored next to the shared cache, per cache
+     * name. How long the recorded lookups took is logged in the
+     * \c kf.guiaddons.imagecache category, and can be compared between runs
+     * with and without recorded keys.
+     *
+     * \sa prefetch()
+     * \since 6.30
+     */
+    void setStartupPrefetching(bool enable)
+    {
+        prefetch(enableStartupPrefetching(enable));
+    }
+
+    /*!
+     * Looks up the pixmaps identified by \a keys in one call, e.g. to fill all
+     * items visible in a view at once.
+     *
+     * Returns the pixmaps that were found, by key. If \a missing is not null, the
+     * keys that could not be found are appended to it, in the order of \a keys.
+     *
+     * \sa findPixmap()
+     * \since 6.30
+     */
+    QHash<QString, QPixmap> findPixmaps(const QStringList &keys, QStringList *missing = nullptr) const
+    {
+        QHash<QString, QPixmap> pixmaps;
+        pixmaps.reserve(keys.size());
+
+        QByteArray cachedData;
+        for (const QString &key : keys) {
+            QPixmap pixmap;
+            if (findLocalPixmap(key, &pixmap)) {
+                pixmaps.insert(key, pixmap);
+            } else if (findSharedData(key, &cachedData)) {
+                pixmap = QPixmap::fromImage(decodeSharedData(key, cachedData), Qt::NoOpaqueDetection);
+                insertLocalPixmap(key, pixmap, cachedData);
+                pixmaps.insert(key, pixmap);
+            } else if (missing) {
+                missing->append(key);
+            }
+        }
+
+        return pixmaps;
+    }
+
+    /*!
+     * Looks up the images identified by \a keys in one call.
+     *
+     * Returns the images that were found, by key. If \a missing is not null, the
+     * keys that could not be found are appended to it, in the order of \a keys.
+     *
+     * \sa findImage()
+     * \since 6.30
+     */
+    QHash<QString, QImage> findImages(const QStringList &keys, QStringList *missing = nullptr) const
+    {
+        QHash<QString, QImage> images;
+        images.reserve(keys.size());
+
+        QByteArray cachedData;
+        for (const QString &key : keys) {
+            if (findSharedData(key, &cachedData)) {
+                images.insert(key, decodeSharedData(key, cachedData));
+            } else if (missing) {
+                missing->append(key);
+            }
+        }
+
+        return images;
+    }
+
     /*!
      * Removes all entries from the cache. In addition any cached pixmaps (as per
      * setPixmapCaching()) are also removed.
@@ -199,6 +520,179 @@ public:
     using KLocalImageCacheImplementation::lastModifiedTime;
 #endif
 
+    /*!
+     * \enum KSharedPixmapCacheMixin::StorageFormat
+     *
+     * The format used to store images in the shared cache.
+     *
+     * \value Png Images are stored PNG-compressed. This is the most compact
+     * format, but every insertion and lookup has to encode or decode the image.
+     * \value Raw Images are stored as uncompressed pixels together with their
+     * size, format and device pixel ratio, so that a lookup is a plain copy.
+     * This takes considerably more space in the cache.
+     * \value Qoi Images are stored losslessly compressed with the QOI algorithm,
+     * which is many times faster than PNG while typically still taking only a
+     * fraction of the space of StorageFormat::Raw for icons and similar images.
+     * QOI only supports 8 bits per channel, so images with more, e.g. in
+     * QImage::Format_RGBA64 or a floating point format, are stored as with
+     * StorageFormat::Raw instead.
+     *
+     * \since 6.30
+     */
+#ifdef Q_QDOC
+    enum class StorageFormat {
+        Png,
+        Raw,
+        Qoi,
+    };
+#else
+    using KLocalImageCacheImplementation::StorageFormat;
+#endif
+
+    /*!
+     * Returns the format used to store newly inserted images in the shared cache.
+     * The default is StorageFormat::Png.
+     *
+     * \since 6.30
+     */
+#ifdef Q_QDOC
+    StorageFormat storageFormat() const;
+#else
+    using KLocalImageCacheImplementation::storageFormat;
+#endif
+
+    /*!
+     * Sets the format used to store newly inserted images in the shared cache to
+     * \a format. Entries in any format can always be found, regardless of the
+     * current setting. Entries stored as StorageFormat::Png are stored again in
+     * the new format when they are found, see upgradeEntries().
+     *
+     * Note that processes using an older version of this class can only read
+     * entries stored as StorageFormat::Png.
+     *
+     * \since 6.30
+     */
+#ifdef Q_QDOC
+    void setStorageFormat(StorageFormat format);
+#else
+    using KLocalImageCacheImplementation::setStorageFormat;
+#endif
+
+    /*!
+     * Returns the generation that images inserted from now on are stamped with.
+     * The default is an empty string, for no generation.
+     *
+     * \sa setGeneration(), invalidateGeneration()
+     * \since 6.30
+     */
+#ifdef Q_QDOC
+    QString generation() const;
+#else
+    using KLocalImageCacheImplementation::generation;
+#endif
+
+    /*!
+     * Stamps images inserted from now on with the generation \a tag, e.g. the
+     * name and version of the icon theme they were rendered with. All entries of
+     * a generation can be invalidated at once with invalidateGeneration().
+     *
+     * Note that stamped images are stored with a header, even in the
+     * StorageFormat::Png format, so processes using an older version of this
+     * class can't read them.
+     *
+     * \sa generation()
+     * \since 6.30
+     */
+#ifdef Q_QDOC
+    void setGeneration(const QString &tag);
+#else
+    using KLocalImageCacheImplementation::setGeneration;
+#endif
+
+    /*!
+     * Returns how long images inserted from now on are valid. The default is
+     * zero, for entries that never expire.
+     *
+     * \sa setTimeToLive()
+     * \since 6.30
+     */
+#ifdef Q_QDOC
+    std::chrono::seconds timeToLive() const;
+#else
+    using KLocalImageCacheImplementation::timeToLive;
+#endif
+
+    /*!
+     * Makes images inserted from now on expire after \a timeToLive. Lookups
+     * of expired entries fail, as if the entries were not in the cache. Zero
+     * disables expiry.
+     *
+     * Note that images with an expiry time are stored with a header, even in
+     * the StorageFormat::Png format, so processes using an older version of
+     * this class can't read them.
+     *
+     * \sa timeToLive()
+     * \since 6.30
+     */
+#ifdef Q_QDOC
+    void setTimeToLive(std::chrono::seconds timeToLive);
+#else
+    using KLocalImageCacheImplementation::setTimeToLive;
+#endif
+
+    /*!
+     * Invalidates all images stamped with the generation \a tag before this
+     * call, in all processes using this cache. Lookups of these entries fail,
+     * as if they were not in the cache, while entries of other generations are
+     * kept. Images inserted with the same generation afterwards are valid.
+     *
+     * The invalidation is stored in a file next to the shared cache, rather
+     * than in the shared cache itself, so that it can't be evicted. Other
+     * processes notice it within about a second. Concurrent invalidations from
+     * several processes are serialized with a lock file. Clearing or deleting
+     * the shared cache doesn't remove the invalidations, but entries inserted
+     * afterwards are valid anyway.
+     *
+     * Returns \c true if the invalidation has been stored. If not, e.g. because
+     * the cache directory is not writable or the lock file is held for more than
+     * a few seconds, \c false is returned, and only this cache object knows
+     * about the invalidation.
+     *
+     * \sa setGeneration()
+     * \since 6.30
+     */
+#ifdef Q_QDOC
+    bool invalidateGeneration(const QString &tag);
+#else
+    using KLocalImageCacheImplementation::invalidateGeneration;
+#endif
+
+    /*!
+     * Stores the images identified by \a keys again in the current storage
+     * format, if they are still stored as StorageFormat::Png, e.g. because they
+     * were inserted by an older version of this class.
+     *
+     * This happens in small steps while the event loop is idle, so it can be
+     * used to migrate a whole cache without blocking the application. Entries
+     * found with findImage() or findPixmap() are upgraded right away anyway.
+     * The shared cache can't list its entries, so \a keys has to name them.
+     *
+     * This does nothing while the storage format is StorageFormat::Png.
+     *
+     * \sa setStorageFormat(), statistics()
+     * \since 6.30
+     */
+    void upgradeEntries(const QStringList &keys)
+    {
+        if (storageFormat() == StorageFormat::Png) {
+            return;
+        }
+
+        scheduleUpgrade(keys, [this](const QString &key) {
+            upgradeEntry(key);
+        });
+    }
+
     /*!
      * Returns if QPixmaps added with insertPixmap() will be stored in a local
      * pixmap cache as well as the shared image cache. The default is to cache
@@ -224,6 +718,40 @@ public:
     using KLocalImageCacheImplementation::setPixmapCaching;
 #endif
 
+    /*!
+     * Returns how often a pixmap added with insertPixmap() needs to be used in
+     * this process before it is also stored in the shared cache. The default is
+     * 0, which stores every pixmap in the shared cache right away.
+     *
+     * \sa setSharedCachePromotionThreshold()
+     * \since 6.30
+     */
+#ifdef Q_QDOC
+    int sharedCachePromotionThreshold() const;
+#else
+    using KLocalImageCacheImplementation::sharedCachePromotionThreshold;
+#endif
+
+    /*!
+     * Sets how often a pixmap added with insertPixmap() needs to be used before
+     * it is also stored in the shared cache to \a uses. Both the insertion and
+     * every later findPixmap() call that is answered by the local pixmap cache
+     * count as a use. Until then the pixmap only lives in the local pixmap cache,
+     * so that images used only once by one process don't evict frequently used
+     * images of other processes from the shared cache.
+     *
+     * Use counts are approximate, and decay over time. A value of 1 or less
+     * disables the policy. It has no effect while pixmap caching is disabled.
+     *
+     * \sa setPixmapCaching()
+     * \since 6.30
+     */
+#ifdef Q_QDOC
+    void setSharedCachePromotionThreshold(int uses);
+#else
+    using KLocalImageCacheImplementation::setSharedCachePromotionThreshold;
+#endif
+
     /*!
      * Returns the highest memory size in bytes to be used by cached pixmaps.
      * \since 4.6
@@ -245,6 +773,211 @@ public:
 #else
     using KLocalImageCacheImplementation::setPixmapCacheLimit;
 #endif
+
+    /*!
+     * Returns the memory in bytes currently used by the pixels of the cached
+     * pixmaps, including the padding at the end of their lines.
+     *
+     * Pixmaps that are implicitly shared copies of each other, e.g. because
+     * the same pixmap was inserted under several keys, are only counted once.
+     * They don't count against pixmapCacheLimit() more than once either.
+     * When the copy that is counted gets evicted, another copy is counted
+     * instead, which marks that copy as recently used.
+     *
+     * \since 6.30
+     */
+#ifdef Q_QDOC
+    qint64 pixmapCacheMemoryUsage() const;
+#else
+    using KLocalImageCacheImplementation::pixmapCacheMemoryUsage;
+#endif
+
+    /*!
+     * Removes the least recently used pixmaps from the local pixmap cache until
+     * the memory they use is at most \a targetCost bytes, e.g. to release memory
+     * while the application is in the background. Unlike setPixmapCacheLimit(),
+     * this does not change how many pixmaps may be cached afterwards.
+     *
+     * The shared cache is not affected.
+     *
+     * \since 6.30
+     */
+#ifdef Q_QDOC
+    void trimLocalCache(int targetCost);
+#else
+    using KLocalImageCacheImplementation::trimLocalCache;
+#endif
+
+    /*!
+     * Returns whether the local pixmap cache is trimmed automatically when the
+     * system is low on memory. The default is \c false.
+     *
+     * \sa setTrimOnMemoryPressure()
+     * \since 6.30
+     */
+#ifdef Q_QDOC
+    bool trimOnMemoryPressure() const;
+#else
+    using KLocalImageCacheImplementation::trimOnMemoryPressure;
+#endif
+
+    /*!
+     * Enables or disables trimming the local pixmap cache to half of its current
+     * size whenever the system is low on memory, according to \a enable.
+     *
+     * This is currently only supported on Linux, where it relies on the pressure
+     * stall information of the cgroup of the process, or of the whole system.
+     * It has no effect elsewhere.
+     *
+     * \sa trimLocalCache()
+     * \since 6.30
+     */
+#ifdef Q_QDOC
+    void setTrimOnMemoryPressure(bool enable);
+#else
+    using KLocalImageCacheImplementation::setTrimOnMemoryPressure;
+#endif
+
+    /*!
+     * \class KSharedPixmapCacheMixin::Statistics
+     * \inmodule KGuiAddons
+     *
+     * \brief Usage statistics of an image cache, as returned by statistics().
+     *
+     * \list
+     * \li localHits: lookups answered by the local pixmap cache
+     * \li sharedHits: lookups answered by the shared cache
+     * \li misses: lookups that found nothing
+     * \li localEvictions: pixmaps dropped from the local pixmap cache to make room
+     * \li bytesInserted: amount of data stored in the shared cache
+     * \li upgradedEntries: PNG entries stored again in the current storage format
+     * \li encodeTime: time spent converting images into the storage format
+     * \li decodeTime: time spent converting cache entries back into images
+     * \endlist
+     *
+     * \since 6.30
+     */
+#ifdef Q_QDOC
+    struct Statistics {
+        qint64 localHits;
+        qint64 sharedHits;
+        qint64 misses;
+        qint64 localEvictions;
+        qint64 bytesInserted;
+        qint64 upgradedEntries;
+        std::chrono::nanoseconds encodeTime;
+        std::chrono::nanoseconds decodeTime;
+    };
+#else
+    using KLocalImageCacheImplementation::Statistics;
+#endif
+
+    /*!
+     * Returns the usage statistics of this cache object since it was created or
+     * since the last call to resetStatistics(). These only cover the calls made
+     * through this object, not those of other processes using the same cache.
+     *
+     * They are also logged when the cache object is destroyed, if the
+     * kf.guiaddons.imagecache logging category is enabled.
+     *
+     * \since 6.30
+     */
+#ifdef Q_QDOC
+    Statistics statistics() const;
+#else
+    using KLocalImageCacheImplementation::statistics;
+#endif
+
+    /*!
+     * Resets all usage statistics to zero.
+     *
+     * \sa statistics()
+     * \since 6.30
+     */
+#ifdef Q_QDOC
+    void resetStatistics();
+#else
+    using KLocalImageCacheImplementation::resetStatistics;
+#endif
+
+private:
+    void registerVariant(const QString &key, const QSize &size, qreal devicePixelRatio)
+    {
+        mergeSharedEntry(variantIndexKey(key), [&size, devicePixelRatio](QByteArray *index) {
+            return addVariant(index, size, devicePixelRatio);
+        });
+    }
+
+    /*
+     * Updates the entry \a key with \a merge, which returns false if the entry
+     * needs no update. KSharedDataCache can't update entries atomically, so
+     * another process may replace the entry between reading and writing it.
+     * The entry is read again after writing it, and merged again if the update
+     * got lost that way. Returns whether the update is stored.
+     */
+    bool mergeSharedEntry(const QString &key, const std::function<bool(QByteArray *)> &merge)
+    {
+        for (int attempt = 0; attempt < 8; ++attempt) {
+            QByteArray data;
+            this->find(key, &data);
+            if (!merge(&data)) {
+                return true;
+            }
+            if (!this->insert(key, data)) {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    bool findLargerVariant(const QString &key, const QSize &size, qreal devicePixelRatio, QImage *image, QByteArray *cachedData = nullptr) const
+    {
+        QByteArray index;
+        if (!this->find(variantIndexKey(key), &index)) {
+            return false;
+        }
+
+        // A variant might have been evicted from the shared cache since it was listed
+        const QStringList candidates = largerVariants(key, index, size, devicePixelRatio);
+        QByteArray data;
+        for (const QString &candidate : candidates) {
+            if (findSharedData(candidate, &data)) {
+                *image = decodeSharedData(candidate, data);
+                if (cachedData) {
+                    *cachedData = data;
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool findSharedData(const QString &key, QByteArray *data) const
+    {
+        recordLookup(key);
+        const bool found = this->find(key, data) && !data->isNull() && !isStale(*data);
+        recordSharedLookup(found);
+        return found;
+    }
+
+    void upgradeEntry(const QString &key)
+    {
+        QByteArray cachedData;
+        if (this->find(key, &cachedData) && !cachedData.isNull()) {
+            upgradeSharedData(key, cachedData);
+        }
+    }
+
+    bool insertSharedData(const QString &key, const QImage &image)
+    {
+        const QByteArray data = serializeImage(image);
+        if (!this->insert(key, data)) {
+            return false;
+        }
+
+        recordInsertion(data.size());
+        return true;
+    }
 };
 
 #endif /* KIMAGECACHE_H */
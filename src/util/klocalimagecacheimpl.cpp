@@ -5,14 +5,673 @@
 */
 
 #include "klocalimagecacheimpl.h"
+#include "kimagecache_debug.h"
 
 #include <QBuffer>
 #include <QCache>
 #include <QCoreApplication>
 #include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QFuture>
+#include <QHash>
+#include <QLockFile>
+#include <QMutex>
+#include <QPromise>
+#include <QSaveFile>
+#include <QSet>
+#include <QStandardPaths>
+#include <QThreadPool>
+#include <QTimer>
 
 #include <QImage>
 #include <QPixmap>
+#include <QSize>
+#include <QStringList>
+
+#ifdef Q_OS_LINUX
+#include <QSocketNotifier>
+
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <vector>
+
+namespace
+{
+/*
+ * Entries stored in a format other than PNG start with this header. PNG data
+ * always starts with "\x89PNG", so the two can never be mistaken for each other
+ * and caches written by older versions remain readable.
+ */
+struct SerializedImageHeader {
+    quint32 magic;
+    quint16 version;
+    quint16 encoding;
+    qint32 width;
+    qint32 height;
+    qint32 bytesPerLine;
+    qint32 format;
+    double devicePixelRatio;
+};
+static_assert(sizeof(SerializedImageHeader) == 32, "pixel data following the header must stay aligned");
+
+constexpr quint32 serializedImageMagic = 0x4b494331; // 'KIC1'
+constexpr quint16 serializedImageVersion = 1;
+
+/*
+ * In this version the header is followed by a stamp, which tells when the entry
+ * has to be considered stale, and only then by the encoded image.
+ */
+constexpr quint16 stampedImageVersion = 2;
+
+struct SerializedImageStamp {
+    // Hash of the generation tag, or 0 for none
+    quint64 generation;
+    // In milliseconds since the epoch, 0 for never
+    qint64 insertedAt;
+    qint64 expiresAt;
+    quint64 reserved;
+};
+static_assert(sizeof(SerializedImageStamp) == 32, "pixel data following the stamp must stay aligned");
+
+enum SerializedImageEncoding : quint16 {
+    RawEncoding = 0,
+    QoiEncoding = 1,
+    PngEncoding = 2,
+};
+
+qsizetype payloadOffset(const SerializedImageHeader &header)
+{
+    return sizeof(SerializedImageHeader) + (header.version == stampedImageVersion ? sizeof(SerializedImageStamp) : 0);
+}
+
+/*
+ * The tag is stored in the shared cache as a hash, which therefore has to be
+ * the same in all processes, unlike qHash(). This is 64-bit FNV-1a.
+ */
+quint64 generationHash(const QString &tag)
+{
+    if (tag.isEmpty()) {
+        return 0;
+    }
+
+    quint64 hash = 0xcbf29ce484222325ULL;
+    const QByteArray data = tag.toUtf8();
+    for (const char c : data) {
+        hash = (hash ^ quint8(c)) * 0x100000001b3ULL;
+    }
+    return hash ? hash : 1;
+}
+
+SerializedImageHeader headerForImage(const QImage &image, SerializedImageEncoding encoding)
+{
+    SerializedImageHeader header;
+    header.magic = serializedImageMagic;
+    header.version = serializedImageVersion;
+    header.encoding = encoding;
+    header.width = image.width();
+    header.height = image.height();
+    header.bytesPerLine = image.bytesPerLine();
+    header.format = image.format();
+    header.devicePixelRatio = image.devicePixelRatio();
+    return header;
+}
+
+/*
+ * Formats with a color table or with non-premultiplied alpha are converted
+ * before storing, so that a cache hit never needs a format conversion to be
+ * painted.
+ */
+QImage::Format rawStorageFormat(const QImage &image)
+{
+    switch (image.format()) {
+    case QImage::Format_Mono:
+    case QImage::Format_MonoLSB:
+    case QImage::Format_Indexed8:
+        return image.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32;
+    case QImage::Format_ARGB32:
+        return QImage::Format_ARGB32_Premultiplied;
+    case QImage::Format_RGBA8888:
+        return QImage::Format_RGBA8888_Premultiplied;
+    case QImage::Format_RGBA64:
+        return QImage::Format_RGBA64_Premultiplied;
+    case QImage::Format_RGBA16FPx4:
+        return QImage::Format_RGBA16FPx4_Premultiplied;
+    case QImage::Format_RGBA32FPx4:
+        return QImage::Format_RGBA32FPx4_Premultiplied;
+    default:
+        return image.format();
+    }
+}
+
+QByteArray encodeRaw(const QImage &source)
+{
+    const QImage image = source.convertToFormat(rawStorageFormat(source));
+    const SerializedImageHeader header = headerForImage(image, RawEncoding);
+
+    QByteArray data(sizeof(header) + image.sizeInBytes(), Qt::Uninitialized);
+    memcpy(data.data(), &header, sizeof(header));
+    if (!image.isNull()) {
+        memcpy(data.data() + sizeof(header), image.constBits(), image.sizeInBytes());
+    }
+    return data;
+}
+
+void releaseImageData(void *data)
+{
+    delete static_cast<QByteArray *>(data);
+}
+
+QImage decodeRaw(const QByteArray &data, const SerializedImageHeader &header)
+{
+    if (header.bytesPerLine <= 0 || qint64(header.bytesPerLine) * header.height > data.size() - payloadOffset(header)) {
+        return QImage();
+    }
+    const int bitsPerPixel = QImage::toPixelFormat(QImage::Format(header.format)).bitsPerPixel();
+    if (header.bytesPerLine % 4 != 0 || qint64(header.width) * bitsPerPixel > qint64(header.bytesPerLine) * 8) {
+        return QImage();
+    }
+
+    const uchar *pixels = reinterpret_cast<const uchar *>(data.constData()) + payloadOffset(header);
+    QImage image;
+
+    // KSharedDataCache already had to copy the entry out of shared memory, so
+    // wrap that copy instead of making another one. The image keeps the byte
+    // array alive and is read-only: modifying it detaches it as usual.
+    if (quintptr(pixels) % 16 == 0) {
+        image = QImage(pixels,
+                       header.width,
+                       header.height,
+                       header.bytesPerLine,
+                       QImage::Format(header.format),
+                       releaseImageData,
+                       new QByteArray(data));
+    } else {
+        image = QImage(header.width, header.height, QImage::Format(header.format));
+        if (image.isNull() || image.bytesPerLine() > header.bytesPerLine) {
+            return QImage();
+        }
+        for (int y = 0; y < header.height; ++y) {
+            memcpy(image.scanLine(y), pixels + qsizetype(y) * header.bytesPerLine, image.bytesPerLine());
+        }
+    }
+
+    return image;
+}
+
+/*
+ * The chunk encoding of QOI, the "Quite OK Image" format (https://qoiformat.org),
+ * applied to premultiplied 32-bit pixels. Being lossless, it doesn't matter that
+ * QOI expects non-premultiplied values. It typically shrinks icons and other UI
+ * images to a fraction of their raw size, while encoding and decoding many
+ * times faster than PNG.
+ */
+constexpr uchar QoiOpIndex = 0x00;
+constexpr uchar QoiOpDiff = 0x40;
+constexpr uchar QoiOpLuma = 0x80;
+constexpr uchar QoiOpRun = 0xc0;
+constexpr uchar QoiOpRgb = 0xfe;
+constexpr uchar QoiOpRgba = 0xff;
+constexpr uchar QoiEndMarker[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+inline int qoiHash(QRgb pixel)
+{
+    return (qRed(pixel) * 3 + qGreen(pixel) * 5 + qBlue(pixel) * 7 + qAlpha(pixel) * 11) % 64;
+}
+
+/*
+ * Whether the pixels of an image in this format are kept exactly by QOI, as
+ * far as 32-bit premultiplied pixels keep those of StorageFormat::Raw. Formats
+ * with more than 8 bits per channel, or with other color models, aren't.
+ */
+bool isQoiRepresentable(QImage::Format format)
+{
+    switch (format) {
+    case QImage::Format_RGB30:
+    case QImage::Format_BGR30:
+    case QImage::Format_A2RGB30_Premultiplied:
+    case QImage::Format_A2BGR30_Premultiplied:
+    case QImage::Format_Grayscale16:
+    case QImage::Format_RGBX64:
+    case QImage::Format_RGBA64:
+    case QImage::Format_RGBA64_Premultiplied:
+    case QImage::Format_RGBX16FPx4:
+    case QImage::Format_RGBA16FPx4:
+    case QImage::Format_RGBA16FPx4_Premultiplied:
+    case QImage::Format_RGBX32FPx4:
+    case QImage::Format_RGBA32FPx4:
+    case QImage::Format_RGBA32FPx4_Premultiplied:
+    case QImage::Format_CMYK8888:
+        return false;
+    default:
+        return true;
+    }
+}
+
+QByteArray encodeQoi(const QImage &source)
+{
+    // The header tells decodeImage() that the image is stored raw instead
+    if (!isQoiRepresentable(source.format())) {
+        return encodeRaw(source);
+    }
+
+    const QImage image = source.convertToFormat(source.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32);
+    const SerializedImageHeader header = headerForImage(image, QoiEncoding);
+
+    // Worst case: every pixel needs a QOI_OP_RGBA chunk
+    QByteArray data(sizeof(header) + qsizetype(image.width()) * image.height() * 5 + sizeof(QoiEndMarker), Qt::Uninitialized);
+    memcpy(data.data(), &header, sizeof(header));
+    uchar *out = reinterpret_cast<uchar *>(data.data()) + sizeof(header);
+
+    std::array<QRgb, 64> index = {};
+    QRgb previous = qRgba(0, 0, 0, 255);
+    int run = 0;
+
+    for (int y = 0; y < image.height(); ++y) {
+        const QRgb *line = reinterpret_cast<const QRgb *>(image.constScanLine(y));
+        for (int x = 0; x < image.width(); ++x) {
+            const QRgb pixel = line[x];
+            if (pixel == previous) {
+                if (++run == 62) {
+                    *out++ = QoiOpRun | (run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+
+            if (run > 0) {
+                *out++ = QoiOpRun | (run - 1);
+                run = 0;
+            }
+
+            const int position = qoiHash(pixel);
+            if (index[position] == pixel) {
+                *out++ = QoiOpIndex | position;
+            } else if (qAlpha(pixel) == qAlpha(previous)) {
+                index[position] = pixel;
+
+                const signed char dr = qRed(pixel) - qRed(previous);
+                const signed char dg = qGreen(pixel) - qGreen(previous);
+                const signed char db = qBlue(pixel) - qBlue(previous);
+                const signed char drg = dr - dg;
+                const signed char dbg = db - dg;
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                    *out++ = QoiOpDiff | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+                } else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+                    *out++ = QoiOpLuma | (dg + 32);
+                    *out++ = (drg + 8) << 4 | (dbg + 8);
+                } else {
+                    *out++ = QoiOpRgb;
+                    *out++ = qRed(pixel);
+                    *out++ = qGreen(pixel);
+                    *out++ = qBlue(pixel);
+                }
+            } else {
+                index[position] = pixel;
+
+                *out++ = QoiOpRgba;
+                *out++ = qRed(pixel);
+                *out++ = qGreen(pixel);
+                *out++ = qBlue(pixel);
+                *out++ = qAlpha(pixel);
+            }
+            previous = pixel;
+        }
+    }
+
+    if (run > 0) {
+        *out++ = QoiOpRun | (run - 1);
+    }
+    memcpy(out, QoiEndMarker, sizeof(QoiEndMarker));
+    out += sizeof(QoiEndMarker);
+
+    data.truncate(out - reinterpret_cast<uchar *>(data.data()));
+    return data;
+}
+
+QImage decodeQoi(const QByteArray &data, const SerializedImageHeader &header)
+{
+    if (header.format != QImage::Format_ARGB32_Premultiplied && header.format != QImage::Format_RGB32) {
+        return QImage();
+    }
+
+    QImage image(header.width, header.height, QImage::Format(header.format));
+    if (image.isNull()) {
+        return QImage();
+    }
+
+    const uchar *in = reinterpret_cast<const uchar *>(data.constData()) + payloadOffset(header);
+    const uchar *const end = reinterpret_cast<const uchar *>(data.constData()) + data.size();
+
+    std::array<QRgb, 64> index = {};
+    QRgb pixel = qRgba(0, 0, 0, 255);
+    int run = 0;
+
+    for (int y = 0; y < image.height(); ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+        for (int x = 0; x < image.width(); ++x) {
+            if (run > 0) {
+                --run;
+            } else {
+                if (in == end) {
+                    return QImage();
+                }
+
+                const uchar op = *in++;
+                if (op == QoiOpRgb) {
+                    if (end - in < 3) {
+                        return QImage();
+                    }
+                    pixel = qRgba(in[0], in[1], in[2], qAlpha(pixel));
+                    in += 3;
+                } else if (op == QoiOpRgba) {
+                    if (end - in < 4) {
+                        return QImage();
+                    }
+                    pixel = qRgba(in[0], in[1], in[2], in[3]);
+                    in += 4;
+                } else {
+                    switch (op & 0xc0) {
+                    case QoiOpIndex:
+                        pixel = index[op];
+                        break;
+                    case QoiOpDiff:
+                        pixel = qRgba(qRed(pixel) + ((op >> 4) & 0x03) - 2,
+                                      qGreen(pixel) + ((op >> 2) & 0x03) - 2,
+                                      qBlue(pixel) + (op & 0x03) - 2,
+                                      qAlpha(pixel));
+                        break;
+                    case QoiOpLuma: {
+                        if (in == end) {
+                            return QImage();
+                        }
+                        const uchar next = *in++;
+                        const int dg = (op & 0x3f) - 32;
+                        pixel = qRgba(qRed(pixel) + dg - 8 + ((next >> 4) & 0x0f),
+                                      qGreen(pixel) + dg,
+                                      qBlue(pixel) + dg - 8 + (next & 0x0f),
+                                      qAlpha(pixel));
+                        break;
+                    }
+                    case QoiOpRun:
+                        run = op & 0x3f;
+                        break;
+                    }
+                }
+                index[qoiHash(pixel)] = pixel;
+            }
+            line[x] = pixel;
+        }
+    }
+
+    return image;
+}
+
+QImage decodePng(const QByteArray &data, const SerializedImageHeader &header)
+{
+    return QImage::fromData(QByteArrayView(data).sliced(payloadOffset(header)), "PNG");
+}
+
+/*
+ * How the pixels following the header are encoded. New encodings only need to
+ * be added here, the header tells decodeImage() which one to use.
+ */
+struct ImageCodec {
+    QByteArray (*encode)(const QImage &image);
+    QImage (*decode)(const QByteArray &data, const SerializedImageHeader &header);
+};
+
+constexpr ImageCodec imageCodecs[] = {
+    /* RawEncoding */ {encodeRaw, decodeRaw},
+    /* QoiEncoding */ {encodeQoi, decodeQoi},
+    // PNG data is stored without a header, so that older versions can read it.
+    // It only gets one to be stamped.
+    /* PngEncoding */ {nullptr, decodePng},
+};
+
+bool readHeader(const QByteArray &data, SerializedImageHeader *header)
+{
+    if (data.size() < qsizetype(sizeof(SerializedImageHeader))) {
+        return false;
+    }
+
+    memcpy(header, data.constData(), sizeof(SerializedImageHeader));
+    return header->magic == serializedImageMagic;
+}
+
+QImage decodeSerializedImage(const QByteArray &data, const SerializedImageHeader &header)
+{
+    if ((header.version != serializedImageVersion && header.version != stampedImageVersion) || header.encoding >= std::size(imageCodecs)) {
+        return QImage();
+    }
+    if (data.size() < payloadOffset(header)) {
+        return QImage();
+    }
+    if (header.width <= 0 || header.height <= 0 || header.format <= QImage::Format_Invalid || header.format >= QImage::NImageFormats) {
+        return QImage();
+    }
+
+    QImage image = imageCodecs[header.encoding].decode(data, header);
+    image.setDevicePixelRatio(header.devicePixelRatio);
+    return image;
+}
+
+bool readStamp(const QByteArray &data, SerializedImageStamp *stamp)
+{
+    SerializedImageHeader header;
+    if (!readHeader(data, &header) || header.version != stampedImageVersion || data.size() < payloadOffset(header)) {
+        return false;
+    }
+
+    memcpy(stamp, data.constData() + sizeof(SerializedImageHeader), sizeof(SerializedImageStamp));
+    return true;
+}
+
+/*
+ * Inserts \a stamp into serialized image data, giving PNG data a header first.
+ */
+QByteArray stampSerializedImage(const QByteArray &data, const QImage &image, const SerializedImageStamp &stamp)
+{
+    SerializedImageHeader header;
+    qsizetype imageDataOffset = sizeof(SerializedImageHeader);
+    if (!readHeader(data, &header)) {
+        header = headerForImage(image, PngEncoding);
+        header.bytesPerLine = 0;
+        imageDataOffset = 0;
+    }
+    header.version = stampedImageVersion;
+
+    QByteArray stamped;
+    stamped.reserve(sizeof(header) + sizeof(stamp) + data.size() - imageDataOffset);
+    stamped.append(reinterpret_cast<const char *>(&header), sizeof(header));
+    stamped.append(reinterpret_cast<const char *>(&stamp), sizeof(stamp));
+    stamped.append(QByteArrayView(data).sliced(imageDataOffset));
+    return stamped;
+}
+
+/*
+ * Approximates how often each key has been used recently, in constant memory.
+ * This is the count-min sketch used by TinyLFU: every key maps to one small
+ * counter in each row, and its frequency is the smallest of those counters.
+ * Counters are halved periodically so that old popularity fades away.
+ */
+class FrequencySketch
+{
+public:
+    void recordUse(const QString &key)
+    {
+        for (int row = 0; row < Depth; ++row) {
+            quint8 &counter = counters[index(key, row)];
+            if (counter < MaxCount) {
+                ++counter;
+            }
+        }
+
+        if (++uses >= 10 * Width) {
+            for (quint8 &counter : counters) {
+                counter /= 2;
+            }
+            uses /= 2;
+        }
+    }
+
+    int frequency(const QString &key) const
+    {
+        int result = MaxCount;
+        for (int row = 0; row < Depth; ++row) {
+            result = qMin<int>(result, counters[index(key, row)]);
+        }
+        return result;
+    }
+
+private:
+    static constexpr int Width = 1024;
+    static constexpr int Depth = 4;
+    static constexpr quint8 MaxCount = 15;
+
+    static size_t index(const QString &key, int row)
+    {
+        return row * Width + qHash(key, 0x9e3779b9U * (row + 1)) % Width;
+    }
+
+    std::array<quint8, Width * Depth> counters = {};
+    int uses = 0;
+};
+
+/*
+ * The variants of an image that have been inserted with insertImageVariant() or
+ * insertPixmapVariant() are listed in an index entry in the shared cache, as a
+ * plain array of these.
+ */
+struct VariantIndexEntry {
+    qint32 width;
+    qint32 height;
+    double devicePixelRatio;
+};
+
+QSize devicePixelSize(const QSize &size, qreal devicePixelRatio)
+{
+    return QSize(qRound(size.width() * devicePixelRatio), qRound(size.height() * devicePixelRatio));
+}
+
+/*
+ * The counters behind KLocalImageCacheImplementation::statistics(). Decoding
+ * can happen in the thread pool, and even finish after the cache object is
+ * gone, so these are atomic and shared with the decoding tasks.
+ */
+struct StatisticsCounters {
+    std::atomic<qint64> localHits{0};
+    std::atomic<qint64> sharedHits{0};
+    std::atomic<qint64> misses{0};
+    std::atomic<qint64> localEvictions{0};
+    std::atomic<qint64> bytesInserted{0};
+    std::atomic<qint64> upgradedEntries{0};
+    std::atomic<qint64> encodeTime{0};
+    std::atomic<qint64> decodeTime{0};
+};
+
+#ifdef Q_OS_LINUX
+/*
+ * Notices when the system is running low on memory using Linux' pressure stall
+ * information: after registering a trigger on a pressure file, the kernel marks
+ * it with POLLPRI whenever tasks were stalled waiting for memory for too long.
+ */
+class MemoryPressureWatcher
+{
+public:
+    explicit MemoryPressureWatcher(const std::function<void()> &callback)
+    {
+        // Stalls of 150ms within 2s. Unprivileged processes may only use
+        // windows that are a multiple of 2s.
+        static const char trigger[] = "some 150000 2000000";
+
+        for (const QString &path : pressureFiles()) {
+            m_fd = open(QFile::encodeName(path).constData(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+            if (m_fd < 0) {
+                continue;
+            }
+            if (write(m_fd, trigger, sizeof(trigger)) == qsizetype(sizeof(trigger))) {
+                break;
+            }
+            close(m_fd);
+            m_fd = -1;
+        }
+
+        if (m_fd < 0) {
+            qCDebug(KIMAGECACHE_LOG) << "No memory pressure information available";
+            return;
+        }
+
+        m_notifier = std::make_unique<QSocketNotifier>(m_fd, QSocketNotifier::Exception);
+        QObject::connect(m_notifier.get(), &QSocketNotifier::activated, m_notifier.get(), callback);
+    }
+
+    ~MemoryPressureWatcher()
+    {
+        m_notifier.reset();
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+    }
+
+    Q_DISABLE_COPY_MOVE(MemoryPressureWatcher)
+
+private:
+    static QStringList pressureFiles()
+    {
+        QStringList files;
+
+        // The pressure within our own cgroup also covers its memory limits
+        QFile cgroups(QStringLiteral("/proc/self/cgroup"));
+        if (cgroups.open(QIODevice::ReadOnly)) {
+            const QList<QByteArray> lines = cgroups.readAll().split('\n');
+            for (const QByteArray &line : lines) {
+                if (line.startsWith("0::")) {
+                    files << QLatin1String("/sys/fs/cgroup") + QString::fromUtf8(line.mid(3)) + QLatin1String("/memory.pressure");
+                }
+            }
+        }
+        files << QStringLiteral("/proc/pressure/memory");
+
+        return files;
+    }
+
+    int m_fd = -1;
+    std::unique_ptr<QSocketNotifier> m_notifier;
+};
+#endif
+
+QImage decodeImage(const QByteArray &data)
+{
+    // Whatever the current storage format is, entries written in any other
+    // format (e.g. by an older version or another process) must stay readable.
+    SerializedImageHeader header;
+    if (readHeader(data, &header)) {
+        return decodeSerializedImage(data, header);
+    }
+
+    return QImage::fromData(data, "PNG");
+}
+
+QImage decodeImage(const QByteArray &data, StatisticsCounters *statistics)
+{
+    QElapsedTimer timer;
+    timer.start();
+    QImage image = decodeImage(data);
+    statistics->decodeTime += timer.nsecsElapsed();
+    return image;
+}
+}
 
 /*
  * This is a QObject subclass so we can catch the signal that the application is about
@@ -22,45 +681,500 @@ class KLocalImageCacheImplementationPrivate : public QObject
 {
     Q_OBJECT
 
-public:
-    KLocalImageCacheImplementationPrivate(QObject *parent = nullptr)
-        : QObject(parent)
-        , timestamp(QDateTime::currentDateTime())
+public:
+    KLocalImageCacheImplementationPrivate(QObject *parent = nullptr)
+        : QObject(parent)
+        , timestamp(QDateTime::currentDateTime())
+    {
+        QObject::connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, this, &KLocalImageCacheImplementationPrivate::clearPixmaps);
+    }
+
+    struct LocalPixmap {
+        LocalPixmap(KLocalImageCacheImplementationPrivate *d, const QString &key, const QPixmap &pixmap, bool shared, const SerializedImageStamp &stamp)
+            : d(d)
+            , key(key)
+            , pixmap(pixmap)
+            , shared(shared)
+            , stamp(stamp)
+        {
+        }
+
+        ~LocalPixmap()
+        {
+            d->releaseBackingStore(pixmap.cacheKey(), key);
+        }
+
+        Q_DISABLE_COPY_MOVE(LocalPixmap)
+
+        KLocalImageCacheImplementationPrivate *const d;
+        const QString key;
+        QPixmap pixmap;
+        // Whether the pixmap has been stored in the shared cache as well
+        bool shared;
+        SerializedImageStamp stamp;
+    };
+
+    /*
+     * The memory used by the pixels of a pixmap. Sizes of pixmaps are in device
+     * pixels already, and raster pixmaps pad their lines to 32 bits like QImage.
+     */
+    static qint64 backingStoreBytes(const QPixmap &pixmap)
+    {
+        const qint64 bytesPerLine = ((qint64(pixmap.width()) * pixmap.depth() + 31) >> 5) << 2;
+        return bytesPerLine * pixmap.height();
+    }
+
+    static int backingStoreCost(qint64 bytes)
+    {
+        return int(qMin<qint64>(bytes, std::numeric_limits<int>::max()));
+    }
+
+    /*
+     * Registers another cached copy of \a pixmap, cached as \a key, and returns
+     * its cost. Copies of a pixmap share its pixels, so only one of them is
+     * charged for them at a time.
+     */
+    int acquireBackingStore(const QString &key, const QPixmap &pixmap)
+    {
+        BackingStore &backingStore = backingStores[pixmap.cacheKey()];
+        backingStore.keys.append(key);
+        if (backingStore.keys.size() > 1) {
+            return 1;
+        }
+
+        backingStore.bytes = backingStoreBytes(pixmap);
+        backingStore.payer = key;
+        bytesUsed += backingStore.bytes;
+        return backingStoreCost(backingStore.bytes);
+    }
+
+    /*
+     * Unregisters the copy cached as \a key. If it was charged for the pixels
+     * and other copies remain, one of them takes over the charge, as the pixels
+     * stay in memory.
+     */
+    void releaseBackingStore(qint64 cacheKey, const QString &key)
+    {
+        auto it = backingStores.find(cacheKey);
+        Q_ASSERT(it != backingStores.end());
+        it->keys.removeOne(key);
+        if (it->keys.isEmpty()) {
+            bytesUsed -= it->bytes;
+            backingStores.erase(it);
+        } else if (it->payer == key) {
+            it->payer = it->keys.constFirst();
+            chargeQueue.append(it->payer);
+        }
+    }
+
+    /*
+     * Charges the copies that took over the charge for their pixels. Their cost
+     * can only change by inserting them again, which can't happen while QCache
+     * is deleting entries, so this has to be called after every operation of
+     * the pixmap cache that may delete entries.
+     *
+     * QCache can't change the cost of an entry in place, so this also makes
+     * the copies the most recently used entries.
+     */
+    void chargeQueuedCopies()
+    {
+        // Inserting a copy again may evict other entries, which may queue
+        // further copies
+        while (!chargeQueue.isEmpty()) {
+            const QString key = chargeQueue.takeFirst();
+            LocalPixmap *localPixmap = pixmapCache.take(key);
+            if (!localPixmap) {
+                continue;
+            }
+            const qint64 bytes = backingStores.value(localPixmap->pixmap.cacheKey()).bytes;
+            pixmapCache.insert(key, localPixmap, backingStoreCost(bytes));
+        }
+    }
+
+    void removePixmap(const QString &key)
+    {
+        pixmapCache.remove(key);
+        chargeQueuedCopies();
+    }
+
+    /*
+     * Inserts a pixmap into the pixmap cache if the pixmap cache is enabled, with
+     * weighting based on the memory used by its pixels. Pixmaps decoded from the
+     * shared cache take the \a stamp of their entry, so that they go stale along
+     * with it.
+     */
+    bool insertPixmap(const QString &key, const QPixmap &pixmap, bool shared, const SerializedImageStamp &stamp)
+    {
+        if (enablePixmapCaching && !pixmap.isNull()) {
+            const qsizetype countBefore = pixmapCache.size() + (pixmapCache.contains(key) ? 0 : 1);
+
+            // Replacing an entry by the same pixmap mustn't count as another copy.
+            // QCache deletes the new entry right away if it doesn't fit, which
+            // releases its backing store again.
+            pixmapCache.remove(key);
+            const int cost = acquireBackingStore(key, pixmap);
+            const bool inserted = pixmapCache.insert(key, new LocalPixmap(this, key, pixmap, shared, stamp), cost);
+            chargeQueuedCopies();
+
+            if (inserted) {
+                statistics->localEvictions += countBefore - pixmapCache.size();
+            }
+            return inserted;
+        }
+
+        return false;
+    }
+
+    /*
+     * The keys looked up right after enabling startup prefetching are recorded
+     * in this file, so that the next run can decode them in the background.
+     */
+    QString startupManifestPath() const
+    {
+        return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QLatin1Char('/') + cacheName + QLatin1String(".kcache-startup");
+    }
+
+    QStringList loadStartupManifest() const
+    {
+        QFile file(startupManifestPath());
+        if (cacheName.isEmpty() || !file.open(QIODevice::ReadOnly)) {
+            return {};
+        }
+
+        QStringList keys;
+        const QList<QByteArray> lines = file.readAll().split('\n');
+        for (const QByteArray &line : lines) {
+            if (!line.isEmpty()) {
+                keys << QString::fromUtf8(line);
+            }
+        }
+        return keys;
+    }
+
+    void recordStartupLookup(const QString &key, bool local)
+    {
+        if (!recordingStartup) {
+            return;
+        }
+
+        if (startupTimer.durationElapsed() > maxStartupDuration) {
+            finishStartupRecording();
+            return;
+        }
+
+        if (local) {
+            ++startupLocalHits;
+        }
+        if (!startupKeySet.contains(key) && !key.contains(QLatin1Char('\n'))) {
+            startupKeySet.insert(key);
+            startupKeys << key;
+        }
+        lastStartupLookup = startupTimer.durationElapsed();
+
+        if (startupKeys.size() >= maxStartupKeys) {
+            finishStartupRecording();
+        }
+    }
+
+    void finishStartupRecording()
+    {
+        recordingStartup = false;
+
+        qCDebug(KIMAGECACHE_LOG) << "startup lookups of" << cacheName << ":" << startupKeys.size() << "keys in"
+                                 << lastStartupLookup.count() / 1000000.0 << "ms, prefetched keys:" << prefetchedKeys
+                                 << "local hits:" << startupLocalHits;
+
+        if (!cacheName.isEmpty() && !startupKeys.isEmpty()) {
+            const QString path = startupManifestPath();
+            QDir().mkpath(QFileInfo(path).absolutePath());
+
+            QSaveFile file(path);
+            if (file.open(QIODevice::WriteOnly)) {
+                file.write(startupKeys.join(QLatin1Char('\n')).toUtf8());
+                file.commit();
+            }
+        }
+
+        startupKeys.clear();
+        startupKeySet.clear();
+    }
+
+    /*
+     * The stamp of entries inserted now, according to the current generation
+     * and time to live.
+     */
+    SerializedImageStamp currentStamp() const
+    {
+        const qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+        SerializedImageStamp stamp = {};
+        stamp.generation = generation;
+        stamp.insertedAt = now;
+        if (timeToLive.count() > 0) {
+            stamp.expiresAt = now + std::chrono::milliseconds(timeToLive).count();
+        }
+        return stamp;
+    }
+
+    bool isStale(const SerializedImageStamp &stamp)
+    {
+        if (stamp.expiresAt != 0 && stamp.expiresAt <= QDateTime::currentMSecsSinceEpoch()) {
+            return true;
+        }
+        if (stamp.generation == 0) {
+            return false;
+        }
+
+        // Other processes may have invalidated generations as well. Checking
+        // for that on every lookup would make lookups much slower.
+        if (!invalidationsAge.isValid() || invalidationsAge.durationElapsed() >= invalidationsReloadInterval) {
+            reloadInvalidations();
+        }
+
+        const auto it = invalidations.constFind(stamp.generation);
+        return it != invalidations.constEnd() && stamp.insertedAt <= it.value();
+    }
+
+    /*
+     * The invalidated generations are stored as pairs of the generation hash
+     * and the time of the invalidation. Not in the shared cache, which could
+     * evict them like any other entry, but in a file next to it.
+     */
+    struct Invalidation {
+        quint64 generation;
+        qint64 invalidatedAt;
+    };
+
+    QString invalidationsPath() const
+    {
+        return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QLatin1Char('/') + cacheName
+            + QLatin1String(".kcache-invalidations");
+    }
+
+    /*
+     * Invalidations are never taken back, so the ones known to this process
+     * are kept even if they couldn't be stored.
+     */
+    void mergeInvalidations(const QByteArray &data)
+    {
+        const qsizetype count = data.size() / qsizetype(sizeof(Invalidation));
+        for (qsizetype i = 0; i < count; ++i) {
+            Invalidation invalidation;
+            memcpy(&invalidation, data.constData() + i * sizeof(Invalidation), sizeof(Invalidation));
+            qint64 &invalidatedAt = invalidations[invalidation.generation];
+            invalidatedAt = qMax(invalidatedAt, invalidation.invalidatedAt);
+        }
+    }
+
+    void reloadInvalidations()
+    {
+        // The file is replaced atomically, so it can be read without locking it
+        QFile file(invalidationsPath());
+        if (!cacheName.isEmpty() && file.open(QIODevice::ReadOnly)) {
+            mergeInvalidations(file.readAll());
+        }
+        invalidationsAge.start();
+    }
+
+    /*
+     * Adds an invalidation to the file. Other processes may be adding theirs at
+     * the same time, so the file is only read and written again while holding
+     * a lock file.
+     */
+    bool storeInvalidation(quint64 generation, qint64 invalidatedAt)
+    {
+        qint64 &known = invalidations[generation];
+        known = qMax(known, invalidatedAt);
+        if (cacheName.isEmpty()) {
+            return false;
+        }
+
+        const QString path = invalidationsPath();
+        QDir().mkpath(QFileInfo(path).absolutePath());
+
+        QLockFile lock(path + QLatin1String(".lock"));
+        if (!lock.tryLock(invalidationsLockTimeout)) {
+            qCWarning(KIMAGECACHE_LOG) << "could not lock" << lock.fileName() << "to invalidate a generation of" << cacheName << ":" << lock.error();
+            return false;
+        }
+
+        QFile file(path);
+        if (file.open(QIODevice::ReadOnly)) {
+            mergeInvalidations(file.readAll());
+            file.close();
+        }
+
+        QSaveFile saveFile(path);
+        if (!saveFile.open(QIODevice::WriteOnly) || saveFile.write(saveInvalidations()) < 0 || !saveFile.commit()) {
+            qCWarning(KIMAGECACHE_LOG) << "could not store the invalidated generations of" << cacheName << "in" << path << ":" << saveFile.errorString();
+            return false;
+        }
+        return true;
+    }
+
+    QByteArray saveInvalidations() const
     {
-        QObject::connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, this, &KLocalImageCacheImplementationPrivate::clearPixmaps);
+        QByteArray data;
+        data.reserve(invalidations.size() * sizeof(Invalidation));
+        for (auto it = invalidations.cbegin(); it != invalidations.cend(); ++it) {
+            const Invalidation invalidation = {it.key(), it.value()};
+            data.append(reinterpret_cast<const char *>(&invalidation), sizeof(invalidation));
+        }
+        return data;
+    }
+
+    void setPixmapCacheLimit(int size)
+    {
+        const qsizetype countBefore = pixmapCache.size();
+        pixmapCache.setMaxCost(size);
+        chargeQueuedCopies();
+        statistics->localEvictions += countBefore - pixmapCache.size();
+    }
+
+    void trimPixmaps(int targetCost)
+    {
+        // QCache evicts the least recently used entries when lowering the limit
+        const int limit = pixmapCache.maxCost();
+        setPixmapCacheLimit(qMax(targetCost, 0));
+        pixmapCache.setMaxCost(limit);
     }
 
     /*
-     * Inserts a pixmap into the pixmap cache if the pixmap cache is enabled, with
-     * weighting based on image size and bit depth.
+     * Whether a pixmap has been used often enough in this process to be worth
+     * storing in the shared cache, where it might evict entries of other processes.
+     */
+    bool isPopular(const QString &key) const
+    {
+        return frequencies.frequency(key) >= promotionThreshold;
+    }
+
+    /*
+     * Upgrades queued entries until the time budget of one event loop iteration
+     * is used up, so that the application stays responsive.
      */
-    bool insertPixmap(const QString &key, QPixmap *pixmap)
+    void upgradeQueuedEntries()
     {
-        if (enablePixmapCaching && pixmap && !pixmap->isNull()) {
-            // "cost" parameter is based on both image size and depth to make cost
-            // based on size in bytes instead of area on-screen.
-            return pixmapCache.insert(key, pixmap, pixmap->width() * pixmap->height() * pixmap->depth() / 8);
+        QElapsedTimer timer;
+        timer.start();
+
+        while (upgradePosition < upgradeQueue.size() && timer.durationElapsed() < upgradeTimeBudget) {
+            upgradeEntry(upgradeQueue.at(upgradePosition++));
         }
 
-        return false;
+        if (upgradePosition == upgradeQueue.size()) {
+            qCDebug(KIMAGECACHE_LOG) << "checked" << upgradeQueue.size() << "entries of" << cacheName << "for upgrades";
+            upgradeTimer.stop();
+            upgradeQueue.clear();
+            upgradePosition = 0;
+        }
     }
 
 public Q_SLOTS:
     void clearPixmaps()
     {
         pixmapCache.clear();
+        chargeQueue.clear();
     }
 
 public:
     QDateTime timestamp;
 
+    /*
+     * Pixel data of the cached pixmaps by QPixmap::cacheKey(), which is the same
+     * for all implicitly shared copies of a pixmap. The copies are listed by
+     * their keys, along with the one that is charged for the pixels.
+     */
+    struct BackingStore {
+        QStringList keys;
+        QString payer;
+        qint64 bytes = 0;
+    };
+    QHash<qint64, BackingStore> backingStores;
+    qint64 bytesUsed = 0;
+    QStringList chargeQueue;
+
     /*
      * This is used to cache pixmaps as they are inserted, instead of always
      * converting to image data and storing that in shared memory.
      */
-    QCache<QString, QPixmap> pixmapCache;
+    QCache<QString, LocalPixmap> pixmapCache;
 
     bool enablePixmapCaching = true;
+
+    /*
+     * Pixmaps are only stored in the shared cache once they have been used this
+     * many times. Values of 1 or less keep the original behavior of storing every
+     * pixmap right away, and don't track uses at all.
+     */
+    int promotionThreshold = 0;
+    FrequencySketch frequencies;
+
+    /*
+     * Stores data in the shared cache. Popular pixmaps are promoted and PNG
+     * entries upgraded to the shared cache during lookups, which can't modify
+     * the mixin itself.
+     */
+    std::function<bool(const QString &, const QByteArray &)> sharedCacheWriter;
+
+    KLocalImageCacheImplementation::StorageFormat storageFormat = KLocalImageCacheImplementation::StorageFormat::Png;
+
+    /*
+     * Decodes currently running in the thread pool, so that concurrent requests
+     * for the same entry share a single decode. Inserting an entry discards its
+     * pending decode, and the id tells the decode that it has been discarded.
+     */
+    struct PendingDecode {
+        QFuture<QImage> future;
+        quint64 id;
+    };
+    QMutex pendingDecodesMutex;
+    QHash<QString, PendingDecode> pendingDecodes;
+    quint64 lastDecodeId = 0;
+
+    std::shared_ptr<StatisticsCounters> statistics = std::make_shared<StatisticsCounters>();
+
+    bool trimOnMemoryPressure = false;
+
+    QString cacheName;
+
+    QString generationTag;
+    quint64 generation = 0;
+    std::chrono::seconds timeToLive{0};
+
+    static constexpr std::chrono::seconds invalidationsReloadInterval{1};
+    static constexpr std::chrono::seconds invalidationsLockTimeout{5};
+    QHash<quint64, qint64> invalidations;
+    QElapsedTimer invalidationsAge;
+
+    /*
+     * Entries queued for being stored in the current storage format, and the
+     * mixin function that does so.
+     */
+    static constexpr std::chrono::milliseconds upgradeTimeBudget{5};
+    QStringList upgradeQueue;
+    qsizetype upgradePosition = 0;
+    std::function<void(const QString &)> upgradeEntry;
+    QTimer upgradeTimer;
+
+    /*
+     * Recording of the keys looked up after enabling startup prefetching stops
+     * after this many keys, or after this time.
+     */
+    static constexpr qsizetype maxStartupKeys = 512;
+    static constexpr std::chrono::seconds maxStartupDuration{10};
+
+    bool startupPrefetching = false;
+    bool recordingStartup = false;
+    QStringList startupKeys;
+    QSet<QString> startupKeySet;
+    QElapsedTimer startupTimer;
+    std::chrono::nanoseconds lastStartupLookup{0};
+    qsizetype prefetchedKeys = 0;
+    qint64 startupLocalHits = 0;
+
+#ifdef Q_OS_LINUX
+    std::unique_ptr<MemoryPressureWatcher> memoryPressureWatcher;
+#endif
 };
 
 KLocalImageCacheImplementation::KLocalImageCacheImplementation(unsigned defaultCacheSize)
@@ -70,33 +1184,180 @@ KLocalImageCacheImplementation::KLocalImageCacheImplementation(unsigned defaultC
     d->pixmapCache.setMaxCost(qMax(defaultCacheSize / 8, (unsigned int)16384));
 }
 
-KLocalImageCacheImplementation::~KLocalImageCacheImplementation() = default;
+KLocalImageCacheImplementation::KLocalImageCacheImplementation(const QString &cacheName, unsigned defaultCacheSize)
+    : KLocalImageCacheImplementation(defaultCacheSize)
+{
+    d->cacheName = cacheName;
+}
+
+KLocalImageCacheImplementation::~KLocalImageCacheImplementation()
+{
+    if (d->recordingStartup) {
+        d->finishStartupRecording();
+    }
+
+    if (KIMAGECACHE_LOG().isDebugEnabled()) {
+        const Statistics stats = statistics();
+        qCDebug(KIMAGECACHE_LOG) << "local hits:" << stats.localHits << "shared hits:" << stats.sharedHits << "misses:" << stats.misses
+                                 << "local evictions:" << stats.localEvictions << "bytes inserted:" << stats.bytesInserted << "upgraded entries:" << stats.upgradedEntries
+                                 << "encode time (ms):" << stats.encodeTime.count() / 1000000.0 << "decode time (ms):" << stats.decodeTime.count() / 1000000.0;
+    }
+}
 
 void KLocalImageCacheImplementation::updateModifiedTime()
 {
     d->timestamp = QDateTime::currentDateTime();
 }
 
+/*
+ * Serializes \a image in the current storage format, stamped with \a stamp
+ * unless that is empty, i.e. has neither a generation nor an expiry time.
+ */
+static QByteArray serializeStampedImage(const QImage &image,
+                                        KLocalImageCacheImplementation::StorageFormat storageFormat,
+                                        const SerializedImageStamp &stamp,
+                                        StatisticsCounters *statistics)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QByteArray data;
+    switch (storageFormat) {
+    case KLocalImageCacheImplementation::StorageFormat::Png: {
+        QBuffer buffer(&data);
+        buffer.open(QBuffer::WriteOnly);
+        image.save(&buffer, "PNG");
+        break;
+    }
+    case KLocalImageCacheImplementation::StorageFormat::Raw:
+        data = imageCodecs[RawEncoding].encode(image);
+        break;
+    case KLocalImageCacheImplementation::StorageFormat::Qoi:
+        data = imageCodecs[QoiEncoding].encode(image);
+        break;
+    }
+
+    if ((stamp.generation != 0 || stamp.expiresAt != 0) && !image.isNull() && !data.isEmpty()) {
+        data = stampSerializedImage(data, image, stamp);
+    }
+
+    statistics->encodeTime += timer.nsecsElapsed();
+    return data;
+}
+
 QByteArray KLocalImageCacheImplementation::serializeImage(const QImage &image) const
 {
-    QBuffer buffer;
-    buffer.open(QBuffer::WriteOnly);
-    image.save(&buffer, "PNG");
-    return buffer.buffer();
+    return serializeStampedImage(image, d->storageFormat, d->currentStamp(), d->statistics.get());
+}
+
+QByteArray KLocalImageCacheImplementation::serializeImage(const QImage &image, const QByteArray &original) const
+{
+    // Entries without a stamp belong to no generation and never expire, and
+    // stay that way
+    SerializedImageStamp stamp = {};
+    readStamp(original, &stamp);
+    return serializeStampedImage(image, d->storageFormat, stamp, d->statistics.get());
+}
+
+QImage KLocalImageCacheImplementation::deserializeImage(const QByteArray &data) const
+{
+    return decodeImage(data, d->statistics.get());
+}
+
+bool KLocalImageCacheImplementation::findPendingImage(const QString &key, QFuture<QImage> *future) const
+{
+    QMutexLocker locker(&d->pendingDecodesMutex);
+    const auto it = d->pendingDecodes.constFind(key);
+    if (it == d->pendingDecodes.constEnd()) {
+        return false;
+    }
+
+    *future = it->future;
+    return true;
+}
+
+void KLocalImageCacheImplementation::discardPendingImage(const QString &key) const
+{
+    QMutexLocker locker(&d->pendingDecodesMutex);
+    d->pendingDecodes.remove(key);
+}
+
+QFuture<QImage> KLocalImageCacheImplementation::deserializeImageAsync(const QString &key, const QByteArray &data) const
+{
+    QMutexLocker locker(&d->pendingDecodesMutex);
+
+    // Somebody else might have started decoding the same entry in the meantime
+    if (const auto it = d->pendingDecodes.constFind(key); it != d->pendingDecodes.constEnd()) {
+        return it->future;
+    }
+
+    auto promise = std::make_shared<QPromise<QImage>>();
+    QFuture<QImage> future = promise->future();
+    promise->start();
+    QThreadPool::globalInstance()->start([promise, data, statistics = d->statistics]() {
+        promise->addResult(decodeImage(data, statistics.get()));
+        promise->finish();
+    });
+    const quint64 id = ++d->lastDecodeId;
+    d->pendingDecodes.insert(key, {future, id});
+
+    // QPixmaps can only be created on the GUI thread, so only that step happens
+    // there, and only if the pixmap is going to be cached at all.
+    KLocalImageCacheImplementationPrivate *priv = d.get();
+    SerializedImageStamp stamp = {};
+    readStamp(data, &stamp);
+    future.then(priv, [priv, key, id, stamp](const QImage &image) {
+        {
+            // The entry may have been inserted again meanwhile, which makes
+            // the decoded image outdated
+            QMutexLocker locker(&priv->pendingDecodesMutex);
+            const auto it = priv->pendingDecodes.constFind(key);
+            if (it == priv->pendingDecodes.constEnd() || it->id != id) {
+                return;
+            }
+            priv->pendingDecodes.erase(it);
+        }
+        if (priv->enablePixmapCaching && !image.isNull()) {
+            priv->insertPixmap(key, QPixmap::fromImage(image, Qt::NoOpaqueDetection), true, stamp);
+        }
+    });
+
+    return future;
 }
 
 bool KLocalImageCacheImplementation::insertLocalPixmap(const QString &key, const QPixmap &pixmap) const
 {
-    return d->insertPixmap(key, new QPixmap(pixmap));
+    return d->insertPixmap(key, pixmap, true, d->currentStamp());
+}
+
+bool KLocalImageCacheImplementation::insertLocalPixmap(const QString &key, const QPixmap &pixmap, const QByteArray &sharedData) const
+{
+    SerializedImageStamp stamp = {};
+    readStamp(sharedData, &stamp);
+    return d->insertPixmap(key, pixmap, true, stamp);
+}
+
+bool KLocalImageCacheImplementation::insertLocalOnlyPixmap(const QString &key, const QPixmap &pixmap) const
+{
+    return d->insertPixmap(key, pixmap, false, d->currentStamp());
 }
 
 bool KLocalImageCacheImplementation::findLocalPixmap(const QString &key, QPixmap *destination) const
 {
     if (d->enablePixmapCaching) {
-        QPixmap *cachedPixmap = d->pixmapCache.object(key);
+        auto *cachedPixmap = d->pixmapCache.object(key);
+        if (cachedPixmap && d->isStale(cachedPixmap->stamp)) {
+            d->removePixmap(key);
+            cachedPixmap = nullptr;
+        }
         if (cachedPixmap) {
             if (destination) {
-                *destination = *cachedPixmap;
+                *destination = cachedPixmap->pixmap;
+            }
+            ++d->statistics->localHits;
+            d->recordStartupLookup(key, true);
+            if (d->promotionThreshold > 1) {
+                d->frequencies.recordUse(key);
             }
 
             return true;
@@ -106,9 +1367,203 @@ bool KLocalImageCacheImplementation::findLocalPixmap(const QString &key, QPixmap
     return false;
 }
 
+bool KLocalImageCacheImplementation::admitToSharedCache(const QString &key) const
+{
+    if (d->promotionThreshold <= 1 || !d->enablePixmapCaching) {
+        return true;
+    }
+
+    d->frequencies.recordUse(key);
+    return d->isPopular(key);
+}
+
+void KLocalImageCacheImplementation::promotePixmap(const QString &key) const
+{
+    if (d->promotionThreshold <= 1 || !d->sharedCacheWriter) {
+        return;
+    }
+
+    auto *cachedPixmap = d->pixmapCache.object(key);
+    if (!cachedPixmap || cachedPixmap->shared || !d->isPopular(key)) {
+        return;
+    }
+
+    // Storing the pixmap doesn't change what lookups will find
+    cachedPixmap->shared = true;
+    const QImage image = cachedPixmap->pixmap.toImage();
+    discardPendingImage(key);
+    const QByteArray data = serializeImage(image);
+    if (d->sharedCacheWriter(key, data)) {
+        recordInsertion(data.size());
+        d->timestamp = QDateTime::currentDateTime();
+    }
+}
+
+void KLocalImageCacheImplementation::setSharedCacheWriter(const std::function<bool(const QString &, const QByteArray &)> &writer)
+{
+    d->sharedCacheWriter = writer;
+}
+
 void KLocalImageCacheImplementation::clearLocalCache()
 {
-    d->pixmapCache.clear();
+    d->clearPixmaps();
+}
+
+void KLocalImageCacheImplementation::recordSharedLookup(bool found) const
+{
+    if (found) {
+        ++d->statistics->sharedHits;
+    } else {
+        ++d->statistics->misses;
+    }
+}
+
+void KLocalImageCacheImplementation::recordInsertion(qsizetype bytes) const
+{
+    d->statistics->bytesInserted += bytes;
+}
+
+bool KLocalImageCacheImplementation::isLegacyData(const QByteArray &data) const
+{
+    SerializedImageHeader header;
+    return d->storageFormat != StorageFormat::Png && (!readHeader(data, &header) || header.encoding == PngEncoding);
+}
+
+bool KLocalImageCacheImplementation::isStale(const QByteArray &data) const
+{
+    SerializedImageStamp stamp;
+    return readStamp(data, &stamp) && d->isStale(stamp);
+}
+
+bool KLocalImageCacheImplementation::invalidateGeneration(const QString &tag)
+{
+    return d->storeInvalidation(generationHash(tag), QDateTime::currentMSecsSinceEpoch());
+}
+
+/*
+ * Decodes an entry of the shared cache. Entries written in the PNG format,
+ * e.g. by versions that didn't support other storage formats yet, are stored
+ * again in the current storage format so that they decode faster next time.
+ */
+QImage KLocalImageCacheImplementation::decodeSharedData(const QString &key, const QByteArray &data) const
+{
+    QImage image = deserializeImage(data);
+    if (!image.isNull() && isLegacyData(data)) {
+        storeUpgradedImage(key, image, data);
+    }
+    return image;
+}
+
+void KLocalImageCacheImplementation::upgradeSharedData(const QString &key, const QByteArray &data) const
+{
+    if (!isLegacyData(data) || isStale(data)) {
+        return;
+    }
+
+    const QImage image = deserializeImage(data);
+    if (!image.isNull()) {
+        storeUpgradedImage(key, image, data);
+    }
+}
+
+/*
+ * Stores \a image again, keeping the generation and expiry time of the
+ * \a original entry rather than making it look freshly inserted.
+ */
+void KLocalImageCacheImplementation::storeUpgradedImage(const QString &key, const QImage &image, const QByteArray &original) const
+{
+    if (!d->sharedCacheWriter) {
+        return;
+    }
+
+    // Storing the image doesn't change what lookups will find
+    const QByteArray data = serializeImage(image, original);
+    if (d->sharedCacheWriter(key, data)) {
+        recordInsertion(data.size());
+        ++d->statistics->upgradedEntries;
+    }
+}
+
+void KLocalImageCacheImplementation::scheduleUpgrade(const QStringList &keys, const std::function<void(const QString &)> &upgrade)
+{
+    if (d->upgradeQueue.isEmpty()) {
+        d->upgradeEntry = upgrade;
+        QObject::connect(&d->upgradeTimer, &QTimer::timeout, d.get(), &KLocalImageCacheImplementationPrivate::upgradeQueuedEntries, Qt::UniqueConnection);
+    }
+
+    d->upgradeQueue += keys;
+    if (!d->upgradeQueue.isEmpty()) {
+        d->upgradeTimer.start(0);
+    }
+}
+
+QString KLocalImageCacheImplementation::variantKey(const QString &key, const QSize &size, qreal devicePixelRatio)
+{
+    // Starts with a control character so that it can't clash with a real key,
+    // and ends with the key so that no key can be mistaken for another's size
+    return QStringLiteral("\x01variant:%1x%2@%3x:").arg(size.width()).arg(size.height()).arg(devicePixelRatio) + key;
+}
+
+QString KLocalImageCacheImplementation::variantIndexKey(const QString &key)
+{
+    // Starts with a control character so that it can't clash with a real key
+    return QLatin1String("\x01variants:") + key;
+}
+
+bool KLocalImageCacheImplementation::addVariant(QByteArray *index, const QSize &size, qreal devicePixelRatio)
+{
+    const qsizetype count = index->size() / qsizetype(sizeof(VariantIndexEntry));
+    for (qsizetype i = 0; i < count; ++i) {
+        VariantIndexEntry entry;
+        memcpy(&entry, index->constData() + i * sizeof(VariantIndexEntry), sizeof(entry));
+        if (entry.width == size.width() && entry.height == size.height() && entry.devicePixelRatio == devicePixelRatio) {
+            return false;
+        }
+    }
+
+    const VariantIndexEntry entry{size.width(), size.height(), devicePixelRatio};
+    index->truncate(count * sizeof(VariantIndexEntry));
+    index->append(reinterpret_cast<const char *>(&entry), sizeof(entry));
+    return true;
+}
+
+QStringList KLocalImageCacheImplementation::largerVariants(const QString &key, const QByteArray &index, const QSize &size, qreal devicePixelRatio)
+{
+    const QSize pixelSize = devicePixelSize(size, devicePixelRatio);
+
+    std::vector<VariantIndexEntry> candidates;
+    const qsizetype count = index.size() / qsizetype(sizeof(VariantIndexEntry));
+    for (qsizetype i = 0; i < count; ++i) {
+        VariantIndexEntry entry;
+        memcpy(&entry, index.constData() + i * sizeof(VariantIndexEntry), sizeof(entry));
+        const QSize candidateSize = devicePixelSize(QSize(entry.width, entry.height), entry.devicePixelRatio);
+        if (candidateSize.width() >= pixelSize.width() && candidateSize.height() >= pixelSize.height()) {
+            candidates.push_back(entry);
+        }
+    }
+
+    // The smallest variant that is large enough needs the least scaling
+    std::sort(candidates.begin(), candidates.end(), [](const VariantIndexEntry &a, const VariantIndexEntry &b) {
+        const QSize sizeA = devicePixelSize(QSize(a.width, a.height), a.devicePixelRatio);
+        const QSize sizeB = devicePixelSize(QSize(b.width, b.height), b.devicePixelRatio);
+        return qint64(sizeA.width()) * sizeA.height() < qint64(sizeB.width()) * sizeB.height();
+    });
+
+    QStringList keys;
+    keys.reserve(candidates.size());
+    for (const VariantIndexEntry &entry : candidates) {
+        keys.append(variantKey(key, QSize(entry.width, entry.height), entry.devicePixelRatio));
+    }
+    return keys;
+}
+
+QImage KLocalImageCacheImplementation::scaledVariant(const QImage &image, const QSize &size, qreal devicePixelRatio)
+{
+    const QSize pixelSize = devicePixelSize(size, devicePixelRatio);
+
+    QImage result = image.size() == pixelSize ? image : image.scaled(pixelSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    result.setDevicePixelRatio(devicePixelRatio);
+    return result;
 }
 
 QDateTime KLocalImageCacheImplementation::lastModifiedTime() const
@@ -116,6 +1571,16 @@ QDateTime KLocalImageCacheImplementation::lastModifiedTime() const
     return d->timestamp;
 }
 
+KLocalImageCacheImplementation::StorageFormat KLocalImageCacheImplementation::storageFormat() const
+{
+    return d->storageFormat;
+}
+
+void KLocalImageCacheImplementation::setStorageFormat(StorageFormat format)
+{
+    d->storageFormat = format;
+}
+
 bool KLocalImageCacheImplementation::pixmapCaching() const
 {
     return d->enablePixmapCaching;
@@ -126,11 +1591,21 @@ void KLocalImageCacheImplementation::setPixmapCaching(bool enable)
     if (enable != d->enablePixmapCaching) {
         d->enablePixmapCaching = enable;
         if (!enable) {
-            d->pixmapCache.clear();
+            d->clearPixmaps();
         }
     }
 }
 
+int KLocalImageCacheImplementation::sharedCachePromotionThreshold() const
+{
+    return d->promotionThreshold;
+}
+
+void KLocalImageCacheImplementation::setSharedCachePromotionThreshold(int uses)
+{
+    d->promotionThreshold = uses;
+}
+
 int KLocalImageCacheImplementation::pixmapCacheLimit() const
 {
     return d->pixmapCache.maxCost();
@@ -138,7 +1613,130 @@ int KLocalImageCacheImplementation::pixmapCacheLimit() const
 
 void KLocalImageCacheImplementation::setPixmapCacheLimit(int size)
 {
-    d->pixmapCache.setMaxCost(size);
+    d->setPixmapCacheLimit(size);
+}
+
+qint64 KLocalImageCacheImplementation::pixmapCacheMemoryUsage() const
+{
+    return d->bytesUsed;
+}
+
+QString KLocalImageCacheImplementation::generation() const
+{
+    return d->generationTag;
+}
+
+void KLocalImageCacheImplementation::setGeneration(const QString &tag)
+{
+    d->generationTag = tag;
+    d->generation = generationHash(tag);
+}
+
+std::chrono::seconds KLocalImageCacheImplementation::timeToLive() const
+{
+    return d->timeToLive;
+}
+
+void KLocalImageCacheImplementation::setTimeToLive(std::chrono::seconds timeToLive)
+{
+    d->timeToLive = qMax(timeToLive, std::chrono::seconds(0));
+}
+
+bool KLocalImageCacheImplementation::startupPrefetching() const
+{
+    return d->startupPrefetching;
+}
+
+QStringList KLocalImageCacheImplementation::enableStartupPrefetching(bool enable)
+{
+    if (enable == d->startupPrefetching) {
+        return {};
+    }
+
+    d->startupPrefetching = enable;
+    if (!enable) {
+        if (d->recordingStartup) {
+            d->finishStartupRecording();
+        }
+        return {};
+    }
+
+    d->recordingStartup = true;
+    d->startupTimer.start();
+    d->startupLocalHits = 0;
+
+    const QStringList keys = d->loadStartupManifest();
+    d->prefetchedKeys = keys.size();
+    return keys;
+}
+
+bool KLocalImageCacheImplementation::hasLocalPixmap(const QString &key) const
+{
+    return d->enablePixmapCaching && d->pixmapCache.contains(key);
+}
+
+void KLocalImageCacheImplementation::recordLookup(const QString &key) const
+{
+    d->recordStartupLookup(key, false);
+}
+
+void KLocalImageCacheImplementation::trimLocalCache(int targetCost)
+{
+    d->trimPixmaps(targetCost);
+}
+
+bool KLocalImageCacheImplementation::trimOnMemoryPressure() const
+{
+    return d->trimOnMemoryPressure;
+}
+
+void KLocalImageCacheImplementation::setTrimOnMemoryPressure(bool enable)
+{
+    if (enable == d->trimOnMemoryPressure) {
+        return;
+    }
+
+    d->trimOnMemoryPressure = enable;
+#ifdef Q_OS_LINUX
+    if (enable) {
+        KLocalImageCacheImplementationPrivate *priv = d.get();
+        d->memoryPressureWatcher = std::make_unique<MemoryPressureWatcher>([priv]() {
+            priv->trimPixmaps(priv->pixmapCache.totalCost() / 2);
+        });
+    } else {
+        d->memoryPressureWatcher.reset();
+    }
+#endif
+}
+
+KLocalImageCacheImplementation::Statistics KLocalImageCacheImplementation::statistics() const
+{
+    const StatisticsCounters &counters = *d->statistics;
+
+    Statistics stats;
+    stats.localHits = counters.localHits.load();
+    stats.sharedHits = counters.sharedHits.load();
+    stats.misses = counters.misses.load();
+    stats.localEvictions = counters.localEvictions.load();
+    stats.bytesInserted = counters.bytesInserted.load();
+    stats.upgradedEntries = counters.upgradedEntries.load();
+    stats.encodeTime = std::chrono::nanoseconds(counters.encodeTime.load());
+    stats.decodeTime = std::chrono::nanoseconds(counters.decodeTime.load());
+    return stats;
+}
+
+void KLocalImageCacheImplementation::resetStatistics()
+{
+    StatisticsCounters &counters = *d->statistics;
+
+    counters.localHits = 0;
+    counters.sharedHits = 0;
+    counters.misses = 0;
+    counters.localEvictions = 0;
+    counters.bytesInserted = 0;
+    counters.upgradedEntries = 0;
+    counters.encodeTime = 0;
+    counters.decodeTime = 0;
 }
 
 #include "klocalimagecacheimpl.moc"
@@ -9,6 +9,11 @@
 
 #include <kguiaddons_export.h>
 
+#include <QtContainerFwd>
+#include <QtGlobal>
+
+#include <chrono>
+#include <functional>
 #include <memory>
 
 class KLocalImageCacheImplementationPrivate;
@@ -17,7 +22,10 @@ class QImage;
 class QPixmap;
 class QByteArray;
 class QDateTime;
+class QSize;
 class QString;
+template<typename T>
+class QFuture;
 
 /*!
  * You are not supposed to use this class directly, use KImageCache instead
@@ -28,27 +36,99 @@ class KGUIADDONS_EXPORT KLocalImageCacheImplementation
 {
 private:
     explicit KLocalImageCacheImplementation(unsigned defaultCacheSize);
+    KLocalImageCacheImplementation(const QString &cacheName, unsigned defaultCacheSize);
 
 public:
+    enum class StorageFormat {
+        Png,
+        Raw,
+        Qoi,
+    };
+
+    struct Statistics {
+        qint64 localHits = 0;
+        qint64 sharedHits = 0;
+        qint64 misses = 0;
+        qint64 localEvictions = 0;
+        qint64 bytesInserted = 0;
+        qint64 upgradedEntries = 0;
+        std::chrono::nanoseconds encodeTime{0};
+        std::chrono::nanoseconds decodeTime{0};
+    };
+
     virtual ~KLocalImageCacheImplementation();
 
     QDateTime lastModifiedTime() const;
 
+    StorageFormat storageFormat() const;
+    void setStorageFormat(StorageFormat format);
+
     bool pixmapCaching() const;
     void setPixmapCaching(bool enable);
 
     int pixmapCacheLimit() const;
     void setPixmapCacheLimit(int size);
+    qint64 pixmapCacheMemoryUsage() const;
+
+    void trimLocalCache(int targetCost);
+    bool trimOnMemoryPressure() const;
+    void setTrimOnMemoryPressure(bool enable);
+
+    int sharedCachePromotionThreshold() const;
+    void setSharedCachePromotionThreshold(int uses);
+
+    Statistics statistics() const;
+    void resetStatistics();
+
+    QString generation() const;
+    void setGeneration(const QString &tag);
+    std::chrono::seconds timeToLive() const;
+    void setTimeToLive(std::chrono::seconds timeToLive);
+    bool invalidateGeneration(const QString &tag);
+
+    bool startupPrefetching() const;
 
 protected:
     void updateModifiedTime();
     QByteArray serializeImage(const QImage &image) const;
+    QImage deserializeImage(const QByteArray &data) const;
+    bool findPendingImage(const QString &key, QFuture<QImage> *future) const;
+    void discardPendingImage(const QString &key) const;
+    QFuture<QImage> deserializeImageAsync(const QString &key, const QByteArray &data) const;
 
     bool insertLocalPixmap(const QString &key, const QPixmap &pixmap) const;
+    bool insertLocalPixmap(const QString &key, const QPixmap &pixmap, const QByteArray &sharedData) const;
+    bool insertLocalOnlyPixmap(const QString &key, const QPixmap &pixmap) const;
     bool findLocalPixmap(const QString &key, QPixmap *destination) const;
+    bool admitToSharedCache(const QString &key) const;
+    void promotePixmap(const QString &key) const;
+    void setSharedCacheWriter(const std::function<bool(const QString &, const QByteArray &)> &writer);
     void clearLocalCache();
+    bool hasLocalPixmap(const QString &key) const;
+
+    QStringList enableStartupPrefetching(bool enable);
+    void recordLookup(const QString &key) const;
+
+    void recordSharedLookup(bool found) const;
+    void recordInsertion(qsizetype bytes) const;
+
+    QImage decodeSharedData(const QString &key, const QByteArray &data) const;
+    void upgradeSharedData(const QString &key, const QByteArray &data) const;
+    void scheduleUpgrade(const QStringList &keys, const std::function<void(const QString &)> &upgrade);
+
+    bool isStale(const QByteArray &data) const;
+
+    static QString variantKey(const QString &key, const QSize &size, qreal devicePixelRatio);
+    static QString variantIndexKey(const QString &key);
+    static bool addVariant(QByteArray *index, const QSize &size, qreal devicePixelRatio);
+    static QStringList largerVariants(const QString &key, const QByteArray &index, const QSize &size, qreal devicePixelRatio);
+    static QImage scaledVariant(const QImage &image, const QSize &size, qreal devicePixelRatio);
 
 private:
+    bool isLegacyData(const QByteArray &data) const;
+    QByteArray serializeImage(const QImage &image, const QByteArray &original) const;
+    void storeUpgradedImage(const QString &key, const QImage &image, const QByteArray &original) const;
+
     std::unique_ptr<KLocalImageCacheImplementationPrivate> const d; ///< @internal
 
     template<class T>
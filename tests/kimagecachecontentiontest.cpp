@@ -0,0 +1,287 @@
+/*
+    SPDX-FileCopyrightText: 2026 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+/*
+ * Runs several processes that use the same KImageCache at the same time, and
+ * reports how long their lookups and insertions took. For example:
+ *
+ *   kimagecachecontentiontest --processes 8 --write-ratio 10 --distribution zipf
+ */
+
+#include <KImageCache>
+
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QGuiApplication>
+#include <QPainter>
+#include <QProcess>
+#include <QRandomGenerator>
+#include <QThread>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <optional>
+#include <vector>
+
+using namespace Qt::Literals::StringLiterals;
+
+namespace
+{
+struct Options {
+    QString cacheName;
+    int cacheSize = 0; // in MiB
+    int processes = 0;
+    int duration = 0; // in seconds
+    int writeRatio = 0; // in percent
+    int keys = 0;
+    int imageSize = 0;
+    bool zipf = false;
+    double zipfExponent = 0;
+};
+
+struct Result {
+    int process = 0;
+    qint64 reads = 0;
+    qint64 writes = 0;
+    qint64 p50 = 0; // in nanoseconds
+    qint64 p99 = 0;
+    qint64 elapsed = 0;
+};
+
+/*
+ * Picks keys either uniformly, or by a Zipf distribution where the key with
+ * rank k is picked with a probability proportional to 1 / k^s, like the icons
+ * of a desktop session.
+ */
+class KeyPicker
+{
+public:
+    KeyPicker(const Options &options, quint32 seed)
+        : m_random(seed)
+        , m_keys(options.keys)
+    {
+        if (options.zipf) {
+            double sum = 0;
+            m_cumulativeWeights.reserve(options.keys);
+            for (int rank = 1; rank <= options.keys; ++rank) {
+                sum += 1.0 / std::pow(rank, options.zipfExponent);
+                m_cumulativeWeights.push_back(sum);
+            }
+        }
+    }
+
+    int next()
+    {
+        if (m_cumulativeWeights.empty()) {
+            return m_random.bounded(m_keys);
+        }
+
+        const double value = m_random.bounded(m_cumulativeWeights.back());
+        const auto it = std::upper_bound(m_cumulativeWeights.cbegin(), m_cumulativeWeights.cend(), value);
+        return qMin(int(it - m_cumulativeWeights.cbegin()), m_keys - 1);
+    }
+
+    bool chance(int percentage)
+    {
+        return int(m_random.bounded(100)) < percentage;
+    }
+
+private:
+    QRandomGenerator m_random;
+    int m_keys;
+    std::vector<double> m_cumulativeWeights;
+};
+
+QImage keyImage(int key, int size)
+{
+    QImage image(size, size, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+
+    QPainter painter(&image);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setBrush(QColor::fromHsv(key * 37 % 360, 200, 200));
+    painter.drawEllipse(image.rect().adjusted(1, 1, -1, -1));
+    painter.end();
+
+    return image;
+}
+
+qint64 percentile(std::vector<qint64> &latencies, int percentage)
+{
+    if (latencies.empty()) {
+        return 0;
+    }
+
+    const auto nth = latencies.begin() + (latencies.size() - 1) * percentage / 100;
+    std::nth_element(latencies.begin(), nth, latencies.end());
+    return *nth;
+}
+
+int runWorker(const Options &options, int process, qint64 startTime)
+{
+    KImageCache cache(options.cacheName, unsigned(options.cacheSize) * 1024 * 1024);
+    cache.setPixmapCaching(false);
+
+    KeyPicker picker(options, process + 1);
+    std::vector<QImage> images;
+    images.reserve(options.keys);
+    for (int key = 0; key < options.keys; ++key) {
+        images.push_back(keyImage(key, options.imageSize));
+    }
+
+    // All processes start at the same time, to contend with each other
+    QThread::msleep(qMax<qint64>(0, startTime - QDateTime::currentMSecsSinceEpoch()));
+
+    Result result;
+    std::vector<qint64> latencies;
+    QElapsedTimer total;
+    total.start();
+
+    QElapsedTimer timer;
+    while (total.elapsed() < options.duration * 1000) {
+        const int key = picker.next();
+        const QString name = u"key-%1"_s.arg(key);
+        const bool write = picker.chance(options.writeRatio);
+
+        timer.start();
+        if (write || !cache.findImage(name, nullptr)) {
+            cache.insertImage(name, images[key]);
+            ++result.writes;
+        } else {
+            ++result.reads;
+        }
+        latencies.push_back(timer.nsecsElapsed());
+    }
+
+    result.elapsed = total.nsecsElapsed();
+    result.p50 = percentile(latencies, 50);
+    result.p99 = percentile(latencies, 99);
+
+    std::printf("%d %lld %lld %lld %lld %lld\n", process, result.reads, result.writes, result.p50, result.p99, result.elapsed);
+    return 0;
+}
+
+std::optional<Result> parseResult(const QByteArray &line)
+{
+    const QList<QByteArray> fields = line.trimmed().split(' ');
+    if (fields.size() != 6) {
+        return std::nullopt;
+    }
+
+    return Result{fields[0].toInt(), fields[1].toLongLong(), fields[2].toLongLong(), fields[3].toLongLong(), fields[4].toLongLong(), fields[5].toLongLong()};
+}
+
+int runCoordinator(const Options &options, const QStringList &arguments)
+{
+    KSharedDataCache::deleteCache(options.cacheName);
+
+    const qint64 startTime = QDateTime::currentMSecsSinceEpoch() + 1000 + options.processes * 50;
+
+    std::vector<std::unique_ptr<QProcess>> workers;
+    for (int process = 0; process < options.processes; ++process) {
+        auto worker = std::make_unique<QProcess>();
+        worker->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+        worker->start(QCoreApplication::applicationFilePath(),
+                      QStringList(arguments) << u"--worker"_s << QString::number(process) << u"--start-time"_s << QString::number(startTime));
+        workers.push_back(std::move(worker));
+    }
+
+    std::vector<Result> results;
+    for (const auto &worker : workers) {
+        worker->waitForFinished(-1);
+        if (const auto result = parseResult(worker->readAllStandardOutput())) {
+            results.push_back(*result);
+        } else {
+            std::fprintf(stderr, "worker failed: %s\n", qPrintable(worker->errorString()));
+        }
+    }
+
+    KSharedDataCache::deleteCache(options.cacheName);
+
+    std::printf("%8s %12s %12s %12s %12s %12s\n", "process", "reads", "writes", "ops/s", "p50 (us)", "p99 (us)");
+    double totalThroughput = 0;
+    for (const Result &result : results) {
+        const double throughput = (result.reads + result.writes) / (result.elapsed / 1e9);
+        totalThroughput += throughput;
+        std::printf("%8d %12lld %12lld %12.0f %12.2f %12.2f\n", result.process, result.reads, result.writes, throughput, result.p50 / 1e3, result.p99 / 1e3);
+    }
+    std::printf("total: %.0f ops/s\n", totalThroughput);
+
+    return int(results.size()) == options.processes ? 0 : 1;
+}
+}
+
+int main(int argc, char *argv[])
+{
+    // Meant to run on build servers and over ssh as well
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(u"Measures the contention of several processes using the same KImageCache"_s);
+    parser.addHelpOption();
+
+    const QCommandLineOption processesOption(u"processes"_s, u"Number of processes using the cache"_s, u"count"_s, u"4"_s);
+    const QCommandLineOption durationOption(u"duration"_s, u"How long to use the cache"_s, u"seconds"_s, u"5"_s);
+    const QCommandLineOption writeRatioOption(u"write-ratio"_s, u"Percentage of operations that insert images"_s, u"percent"_s, u"5"_s);
+    const QCommandLineOption keysOption(u"keys"_s, u"Number of different images"_s, u"count"_s, u"1000"_s);
+    const QCommandLineOption imageSizeOption(u"image-size"_s, u"Width and height of the images"_s, u"pixels"_s, u"32"_s);
+    const QCommandLineOption distributionOption(u"distribution"_s, u"Distribution of the used keys: uniform or zipf"_s, u"name"_s, u"uniform"_s);
+    const QCommandLineOption zipfExponentOption(u"zipf-exponent"_s, u"Exponent of the Zipf distribution"_s, u"exponent"_s, u"1.0"_s);
+    const QCommandLineOption cacheSizeOption(u"cache-size"_s, u"Size of the shared cache"_s, u"MiB"_s, u"10"_s);
+    const QCommandLineOption cacheNameOption(u"cache-name"_s, u"Name of the shared cache"_s, u"name"_s, u"kimagecachecontentiontest"_s);
+    QCommandLineOption workerOption(u"worker"_s, u"Internal: index of the worker process"_s, u"index"_s);
+    QCommandLineOption startTimeOption(u"start-time"_s, u"Internal: when workers start"_s, u"msecs"_s);
+    workerOption.setFlags(QCommandLineOption::HiddenFromHelp);
+    startTimeOption.setFlags(QCommandLineOption::HiddenFromHelp);
+
+    parser.addOptions({processesOption,
+                       durationOption,
+                       writeRatioOption,
+                       keysOption,
+                       imageSizeOption,
+                       distributionOption,
+                       zipfExponentOption,
+                       cacheSizeOption,
+                       cacheNameOption,
+                       workerOption,
+                       startTimeOption});
+    parser.process(app);
+
+    Options options;
+    options.processes = qMax(1, parser.value(processesOption).toInt());
+    options.duration = qMax(1, parser.value(durationOption).toInt());
+    options.writeRatio = qBound(0, parser.value(writeRatioOption).toInt(), 100);
+    options.keys = qMax(1, parser.value(keysOption).toInt());
+    options.imageSize = qMax(1, parser.value(imageSizeOption).toInt());
+    options.zipf = parser.value(distributionOption) == u"zipf";
+    options.zipfExponent = parser.value(zipfExponentOption).toDouble();
+    options.cacheSize = qMax(1, parser.value(cacheSizeOption).toInt());
+    options.cacheName = parser.value(cacheNameOption);
+
+    if (parser.isSet(workerOption)) {
+        return runWorker(options, parser.value(workerOption).toInt(), parser.value(startTimeOption).toLongLong());
+    }
+
+    std::printf("%d processes, %d%% writes, %d keys (%s), %dx%d images, %d MiB cache\n",
+                options.processes,
+                options.writeRatio,
+                options.keys,
+                options.zipf ? "zipf" : "uniform",
+                options.imageSize,
+                options.imageSize,
+                options.cacheSize);
+    std::fflush(stdout);
+
+    // Workers get the same options
+    return runCoordinator(options, app.arguments().mid(1));
+}